@@ -0,0 +1,154 @@
+#include "magikacpp.h"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+// Batch sizes compared, 1 runs the model once per input as scanBuffer does
+static const size_t kBatchSizes[] = { 1, 4, 16, 32, 64, 128, 256 };
+
+// BenchConcurrent runs threads clients each scanning its share of the
+// buffers one at a time with scanBuffer, on the sessions of the scanner
+static void BenchConcurrent(const std::vector<BufferView>& buffers, size_t threads, size_t sessions) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> clients;
+  for (size_t t = 0; t < threads; t++) {
+    clients.emplace_back([&, t] {
+      for (size_t i = t; i < buffers.size(); i += threads) {
+        MagikaScanner::scanBufferWithFingerprint(buffers[i].data, buffers[i].size);
+      }
+    });
+  }
+  for (std::thread& client : clients) {
+    client.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  
+  std::cout << "concurrent, " << threads << " clients, " << sessions << " sessions: " << (buffers.size() / seconds)
+            << " inputs/s" << std::endl;
+}
+
+// BenchScheduler runs threads clients each scanning its share of the
+// buffers one at a time through a MagikaBatchScheduler, as the handlers of
+// a service would
+static void BenchScheduler(const std::vector<BufferView>& buffers, size_t threads) {
+  BatchSchedulerOptions options;
+  options.max_batch = threads;
+  MagikaBatchScheduler scheduler(options);
+  
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> clients;
+  for (size_t t = 0; t < threads; t++) {
+    clients.emplace_back([&, t] {
+      for (size_t i = t; i < buffers.size(); i += threads) {
+        scheduler.scanBuffer(buffers[i].data, buffers[i].size).get();
+      }
+    });
+  }
+  for (std::thread& client : clients) {
+    client.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  
+  BatchSchedulerStats stats = scheduler.stats();
+  std::cout << "scheduler, " << threads << " clients: " << (buffers.size() / seconds) << " inputs/s, "
+            << "mean batch " << (stats.batches ? static_cast<double>(stats.requests) / stats.batches : 0.0)
+            << ", " << stats.full_batches << "/" << stats.batches << " full batches, mean queue wait "
+            << (stats.requests ? stats.total_queue_wait_us / stats.requests : 0) << " us, max "
+            << stats.max_queue_wait_us << " us" << std::endl;
+}
+
+// ReadFile loads a whole file, the benchmark only measures extraction and
+// inference
+static std::vector<uint8_t> ReadFile(const std::string& filepath) {
+  std::ifstream file(filepath, std::ios::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <model_path> <file>... [--inputs N] [--threads T] [--sessions S]" << std::endl;
+    std::cerr << "Example: " << argv[0] << " ./models/standard_v3_3/model.onnx ./data/*" << std::endl;
+    return 1;
+  }
+  
+  // The files are scanned again and again until there are this many inputs
+  size_t inputs = 4096;
+  // With --threads, single inputs are also scanned concurrently through the
+  // batch scheduler
+  size_t threads = 0;
+  // Sessions the concurrent clients are compared on, from 1 to this many
+  size_t sessions = 1;
+  std::vector<std::vector<uint8_t>> contents;
+  for (int i = 2; i < argc; i++) {
+    if (std::string(argv[i]) == "--inputs" && i + 1 < argc) {
+      inputs = std::strtoul(argv[++i], nullptr, 10);
+      continue;
+    }
+    if (std::string(argv[i]) == "--threads" && i + 1 < argc) {
+      threads = std::strtoul(argv[++i], nullptr, 10);
+      continue;
+    }
+    if (std::string(argv[i]) == "--sessions" && i + 1 < argc) {
+      sessions = std::strtoul(argv[++i], nullptr, 10);
+      continue;
+    }
+    contents.push_back(ReadFile(argv[i]));
+  }
+  if (contents.empty() || inputs == 0) {
+    std::cerr << "Nothing to scan" << std::endl;
+    return 1;
+  }
+  
+  std::vector<BufferView> buffers(inputs);
+  for (size_t i = 0; i < inputs; i++) {
+    const std::vector<uint8_t>& content = contents[i % contents.size()];
+    buffers[i] = BufferView{ content.data(), content.size() };
+  }
+  
+  try {
+    for (size_t batch_size : kBatchSizes) {
+      ScannerOptions options;
+      options.batch_size = batch_size;
+      MagikaScanner::initialize(argv[1], options);
+  
+      // Warm up the session before timing it
+      MagikaScanner::scanBuffers(std::vector<BufferView>(buffers.begin(), buffers.begin() + std::min(inputs, batch_size)));
+  
+      auto start = std::chrono::steady_clock::now();
+      std::vector<ScanResult> results = MagikaScanner::scanBuffers(buffers);
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  
+      size_t errors = 0;
+      for (const ScanResult& result : results) {
+        if (!result.error.empty()) {
+          errors++;
+        }
+      }
+      std::cout << "batch " << batch_size << ": " << (inputs / seconds) << " inputs/s, "
+                << (seconds * 1e6 / inputs) << " us per input, " << errors << " errors" << std::endl;
+    }
+    
+    if (threads > 0) {
+      for (size_t session_count = 1; session_count <= sessions; session_count *= 2) {
+        ScannerOptions options;
+        options.sessions = session_count;
+        MagikaScanner::initialize(argv[1], options);
+        BenchConcurrent(buffers, threads, session_count);
+      }
+      
+      MagikaScanner::initialize(argv[1]);
+      BenchScheduler(buffers, threads);
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Error running benchmark: " << e.what() << std::endl;
+    return 1;
+  }
+  
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include "bytekernels.h"
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+// Feature segments of standard_v3_3: 1024 beg tokens and 1024 end tokens
+static const size_t kSegmentSize = 1024;
+
+// Shapes exercised per iteration: a full block, a short file padded at the
+// end, and a block that is mostly padding
+static const size_t kCounts[] = { 1024, 700, 37 };
+static const size_t kShapes = sizeof(kCounts) / sizeof(kCounts[0]);
+
+// Rounds per kernel set, interleaved across the sets so that a noisy host
+// slows them all alike, the median round is reported
+static const size_t kRounds = 9;
+
+// PadInt32PushBack is the original push_back loop, kept as the reference
+static void PadInt32PushBack(const uint8_t* bytes, size_t count, size_t prefix, size_t size, int padding_token,
+                             std::vector<int32_t>& result) {
+  result.clear();
+  result.reserve(size);
+  
+  for (size_t i = 0; i < prefix; i++) {
+    result.push_back(padding_token);
+  }
+  
+  size_t bytes_to_add = count < size - prefix ? count : size - prefix;
+  for (size_t i = 0; i < bytes_to_add; i++) {
+    result.push_back(static_cast<int32_t>(bytes[i]));
+  }
+  
+  size_t suffix_padding = size - prefix - bytes_to_add;
+  for (size_t i = 0; i < suffix_padding; i++) {
+    result.push_back(padding_token);
+  }
+}
+
+// Report prints the throughput of one variant, in tokens written per second
+static void Report(const char* name, double seconds, size_t tokens, int64_t checksum) {
+  std::cout << name << ": " << (tokens / seconds / 1e9) << " Gtokens/s, "
+            << (seconds * 1e9 / (tokens / (2.0 * kSegmentSize))) << " ns per file"
+            << " (checksum " << checksum << ")" << std::endl;
+}
+
+// TimeInt32 runs one round of the int32 kernels and returns its duration in seconds
+static double TimeInt32(const ByteKernels& kernels, const std::vector<uint8_t>& bytes, size_t iterations,
+                        std::vector<int32_t>& out, int64_t& checksum) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t it = 0; it < iterations; it++) {
+    for (size_t s = 0; s < kShapes; s++) {
+      size_t prefix = kSegmentSize - kCounts[s];
+      kernels.widen(bytes.data(), kCounts[s], out.data());
+      kernels.fill(out.data() + kCounts[s], prefix, 256);
+      checksum += out[it % kSegmentSize];
+      kernels.fill(out.data(), prefix, 256);
+      kernels.widen(bytes.data(), kCounts[s], out.data() + prefix);
+      checksum += out[it % kSegmentSize];
+    }
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// TimeUint16 is TimeInt32 for the kernels writing uint16 tokens
+static double TimeUint16(const ByteKernels& kernels, const std::vector<uint8_t>& bytes, size_t iterations,
+                         std::vector<uint16_t>& out, int64_t& checksum) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t it = 0; it < iterations; it++) {
+    for (size_t s = 0; s < kShapes; s++) {
+      size_t prefix = kSegmentSize - kCounts[s];
+      kernels.widen16(bytes.data(), kCounts[s], out.data());
+      kernels.fill16(out.data() + kCounts[s], prefix, 256);
+      checksum += out[it % kSegmentSize];
+      kernels.fill16(out.data(), prefix, 256);
+      kernels.widen16(bytes.data(), kCounts[s], out.data() + prefix);
+      checksum += out[it % kSegmentSize];
+    }
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Median returns the median of the round durations
+static double Median(std::vector<double> seconds) {
+  std::sort(seconds.begin(), seconds.end());
+  return seconds[seconds.size() / 2];
+}
+
+int main(int argc, char* argv[]) {
+  size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+  
+  std::vector<uint8_t> bytes(kSegmentSize);
+  for (size_t i = 0; i < bytes.size(); i++) {
+    bytes[i] = static_cast<uint8_t>(i * 131 + 7);
+  }
+  
+  const size_t tokens = iterations * kShapes * 2 * kSegmentSize;
+  std::vector<int32_t> out(kSegmentSize);
+  
+  // Reference loop
+  {
+    int64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t it = 0; it < iterations; it++) {
+      for (size_t s = 0; s < kShapes; s++) {
+        // beg is padded at the end, end is padded at the front
+        PadInt32PushBack(bytes.data(), kCounts[s], 0, kSegmentSize, 256, out);
+        checksum += out[it % kSegmentSize];
+        PadInt32PushBack(bytes.data(), kCounts[s], kSegmentSize - kCounts[s], kSegmentSize, 256, out);
+        checksum += out[it % kSegmentSize];
+      }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    Report("push_back", elapsed.count(), tokens, checksum);
+  }
+  
+  // Every kernel set supported by this CPU, the last one is the one selected
+  const ByteKernels* kernels[8];
+  size_t kernel_count = ListByteKernels(kernels, 8);
+  std::vector<std::vector<double>> seconds(kernel_count), seconds16(kernel_count);
+  std::vector<int64_t> checksums(kernel_count, 0), checksums16(kernel_count, 0);
+  const size_t round_iterations = iterations < kRounds ? 1 : iterations / kRounds;
+  // The same kernels writing uint16 tokens, for models taking them
+  std::vector<uint16_t> out16(kSegmentSize);
+  for (size_t round = 0; round < kRounds; round++) {
+    for (size_t k = 0; k < kernel_count; k++) {
+      seconds[k].push_back(TimeInt32(*kernels[k], bytes, round_iterations, out, checksums[k]));
+      seconds16[k].push_back(TimeUint16(*kernels[k], bytes, round_iterations, out16, checksums16[k]));
+    }
+  }
+  
+  const size_t round_tokens = round_iterations * kShapes * 2 * kSegmentSize;
+  for (size_t k = 0; k < kernel_count; k++) {
+    Report(kernels[k]->name, Median(seconds[k]), round_tokens, checksums[k]);
+  }
+  for (size_t k = 0; k < kernel_count; k++) {
+    Report((std::string(kernels[k]->name) + " uint16").c_str(), Median(seconds16[k]), round_tokens, checksums16[k]);
+  }
+  
+  std::cout << "selected: " << SelectByteKernels().name << std::endl;
+  return 0;
+}
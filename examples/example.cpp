@@ -1,11 +1,13 @@
 #include "magikacpp.h"
 #include <iostream>
 #include <string>
+#include <cstdio>
 
 int main(int argc, char* argv[]) {
   if (argc < 3) {
     std::cerr << "Usage: " << argv[0] << " <model_path> <file_path1> [file_path2] ..." << std::endl;
     std::cerr << "Example: " << argv[0] << " ./models/standard_v3_3/model.onnx ./test.txt" << std::endl;
+    std::cerr << "Use - as file path to scan standard input" << std::endl;
     return 1;
   }
 
@@ -21,7 +23,19 @@ int main(int argc, char* argv[]) {
       
       try {
         // Scan file and get content type and confidence score
-        auto result = MagikaScanner::scanFileWithScore(filepath);
+        std::pair<std::string, float> result;
+        if (filepath == "-") {
+          // Standard input is not seekable, feed it incrementally
+          MagikaStreamScanner stream_scanner;
+          uint8_t buffer[65536];
+          size_t n;
+          while ((n = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+            stream_scanner.push(buffer, n);
+          }
+          result = stream_scanner.finish();
+        } else {
+          result = MagikaScanner::scanFileWithScore(filepath);
+        }
         
         // Print results
         std::cout << filepath << ": " << result.first 
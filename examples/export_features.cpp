@@ -0,0 +1,45 @@
+#include "featureexport.h"
+#include "config.h"
+#include <iostream>
+#include <string>
+#include <cstring>
+
+int main(int argc, char* argv[]) {
+  if (argc < 4) {
+    std::cerr << "Usage: " << argv[0] << " <assets_dir> <model_name> <output_prefix> [--uint16] < file_list" << std::endl;
+    std::cerr << "Example: find /data -type f | " << argv[0] << " ./models standard_v3_3 ./corpus" << std::endl;
+    std::cerr << "Writes <output_prefix>.npy and <output_prefix>.index.tsv" << std::endl;
+    return 1;
+  }
+  
+  TokenType token_type = TokenType::kInt32;
+  if (argc > 4 && std::strcmp(argv[4], "--uint16") == 0) {
+    token_type = TokenType::kUInt16;
+  }
+  
+  try {
+    Config cfg = Config::ReadConfig(argv[1], argv[2]);
+    std::string prefix = argv[3];
+    FeatureExporter exporter(cfg, prefix + ".npy", prefix + ".index.tsv", token_type);
+  
+    // One path per line
+    size_t files = 0;
+    std::string filepath;
+    while (std::getline(std::cin, filepath)) {
+      if (filepath.empty()) {
+        continue;
+      }
+      exporter.Add(filepath);
+      files++;
+    }
+    exporter.Close();
+  
+    std::cout << "Exported " << exporter.rows() << " rows from " << files << " files to " << prefix << ".npy"
+              << std::endl;
+  } catch (const std::exception& e) {
+    std::cerr << "Error exporting features: " << e.what() << std::endl;
+    return 1;
+  }
+  
+  return 0;
+}
@@ -0,0 +1,46 @@
+"""Write a variant of a Magika model that takes uint16 tokens.
+
+A Cast node is inserted in front of the graph, so the scanner builds and
+batches rows of uint16 tokens, half the size of int32 ones, and the model
+widens them itself. MagikaScanner detects the input type when initialized.
+
+Usage: python make_uint16_model.py models/standard_v3_3/model.onnx models/standard_v3_3/model_uint16.onnx
+The variant must be kept next to config.min.json, like the original model.
+Requires the onnx package (pip install onnx).
+"""
+
+import sys
+
+import onnx
+from onnx import TensorProto, helper
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__)
+        return 1
+
+    model = onnx.load(sys.argv[1])
+    graph = model.graph
+    tokens = graph.input[0]
+    if tokens.type.tensor_type.elem_type != TensorProto.INT32:
+        print("Model input %s is not int32 tokens" % tokens.name)
+        return 1
+
+    # Nodes read the widened tokens, the graph input becomes uint16
+    widened = tokens.name + "_int32"
+    for node in graph.node:
+        for i, name in enumerate(node.input):
+            if name == tokens.name:
+                node.input[i] = widened
+    tokens.type.tensor_type.elem_type = TensorProto.UINT16
+    graph.node.insert(0, helper.make_node("Cast", [tokens.name], [widened], to=TensorProto.INT32,
+                                          name="tokens_to_int32"))
+
+    onnx.checker.check_model(model)
+    onnx.save(model, sys.argv[2])
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
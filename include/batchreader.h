@@ -0,0 +1,79 @@
+#ifndef MAGIKACPP_BATCHREADER_H_
+#define MAGIKACPP_BATCHREADER_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "config.h"
+#include "filefeatures.h"
+#include "seekable.h"
+
+/**
+ * BatchItem is handed to the batch callback once all the feature ranges of
+ * one file have been read, or reading it failed.
+ */
+struct BatchItem {
+  // Position of the file in the list passed to BatchReader::Read
+  size_t index;
+  // Ranges read from the file, nullptr when error is set
+  const FeatureReads* reads;
+  // Empty on success, otherwise the reason the file could not be read
+  std::string error;
+};
+
+typedef std::function<void(const BatchItem&)> BatchCallback;
+
+/**
+ * BatchReader reads the feature ranges of many files. On Linux kernels with
+ * io_uring it keeps up to queue_depth files in flight, submitting their
+ * openat/statx/read/close operations in batches. Otherwise, and for direct
+ * I/O, it falls back to reading the files one after the other through
+ * Seekable.
+ */
+class BatchReader {
+ private:
+  class Ring;
+  
+  const Config& config;
+  unsigned queue_depth;
+  ReadHints hints;
+  std::unique_ptr<Ring> ring;
+  
+  void ReadWithRing(const std::vector<std::string>& filepaths, const BatchCallback& callback);
+  void ReadWithSeekable(const std::vector<std::string>& filepaths, const BatchCallback& callback);
+  
+ public:
+  /**
+   * Constructor, sets up io_uring when the kernel supports it
+   * @param cfg Configuration parameters, must outlive the reader
+   * @param queue_depth Maximum number of files in flight
+   * @param hints Access hints given to the kernel
+   */
+  BatchReader(const Config& cfg, unsigned queue_depth, const ReadHints& hints = ReadHints());
+  
+  /**
+   * Destructor
+   */
+  ~BatchReader();
+  
+  BatchReader(const BatchReader&) = delete;
+  BatchReader& operator=(const BatchReader&) = delete;
+  
+  /**
+   * Whether files are read through io_uring
+   * @return False when falling back to Seekable
+   */
+  bool uses_io_uring() const;
+  
+  /**
+   * Read the feature ranges of the given files. The callback is called once
+   * per file, in completion order, as soon as its ranges are available; the
+   * item is only valid during the call. The callback must not throw.
+   * @param filepaths Paths of the files to read
+   * @param callback Called for each file
+   */
+  void Read(const std::vector<std::string>& filepaths, const BatchCallback& callback);
+};
+
+#endif  // MAGIKACPP_BATCHREADER_H_
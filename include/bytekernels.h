@@ -0,0 +1,88 @@
+#ifndef MAGIKACPP_BYTEKERNELS_H_
+#define MAGIKACPP_BYTEKERNELS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * ByteKernels holds the implementations of the inner loops of feature
+ * construction for one instruction set. The best set supported by the CPU
+ * is selected once at runtime, so the library is built for the baseline
+ * architecture and still uses SSE4.1, AVX2 or AVX-512 where available.
+ */
+struct ByteKernels {
+  // Name of the instruction set, for diagnostics and benchmarks
+  const char* name;
+  // Widen count bytes into count int32 tokens
+  void (*widen)(const uint8_t* bytes, size_t count, int32_t* out);
+  // Set count int32 tokens to value
+  void (*fill)(int32_t* out, size_t count, int32_t value);
+  // Index of the first byte that is not one of "\t\n\v\f\r ", count if
+  // there is none
+  size_t (*skip_whitespace)(const uint8_t* bytes, size_t count);
+  // Number of bytes left once trailing "\t\n\v\f\r " are stripped, that
+  // is the index after the last byte that is not whitespace
+  size_t (*trim_whitespace)(const uint8_t* bytes, size_t count);
+  // Widen count bytes into count uint16 tokens
+  void (*widen16)(const uint8_t* bytes, size_t count, uint16_t* out);
+  // Set count uint16 tokens to value
+  void (*fill16)(uint16_t* out, size_t count, uint16_t value);
+};
+
+/**
+ * SelectByteKernels returns the fastest kernels supported by the CPU. The
+ * CPU is only probed on the first call.
+ * @return Selected kernels
+ */
+const ByteKernels& SelectByteKernels();
+
+/**
+ * ListByteKernels returns every set of kernels supported by the CPU, from
+ * the scalar fallback to the fastest one, to compare them in benchmarks.
+ * @param kernels Array receiving the kernels
+ * @param max_count Size of the array
+ * @return Number of kernels written
+ */
+size_t ListByteKernels(const ByteKernels** kernels, size_t max_count);
+
+/**
+ * WidenPad writes a feature segment of size tokens: prefix padding tokens,
+ * then up to size - prefix bytes widened to int32, then padding tokens up
+ * to the end of the segment.
+ * @param bytes Bytes of the segment
+ * @param count Number of bytes available
+ * @param prefix Number of leading padding tokens, at most size
+ * @param size Number of tokens in the segment
+ * @param padding_token Token used for padding
+ * @param out Segment receiving the tokens
+ */
+inline void WidenPad(const uint8_t* bytes, size_t count, size_t prefix, size_t size, int32_t padding_token,
+                     int32_t* out) {
+  const ByteKernels& kernels = SelectByteKernels();
+  size_t bytes_to_add = count < size - prefix ? count : size - prefix;
+  kernels.fill(out, prefix, padding_token);
+  kernels.widen(bytes, bytes_to_add, out + prefix);
+  kernels.fill(out + prefix + bytes_to_add, size - prefix - bytes_to_add, padding_token);
+}
+
+/**
+ * WidenPad writes a feature segment of size uint16 tokens, see above. The
+ * padding token must fit in 16 bits.
+ * @param bytes Bytes of the segment
+ * @param count Number of bytes available
+ * @param prefix Number of leading padding tokens, at most size
+ * @param size Number of tokens in the segment
+ * @param padding_token Token used for padding
+ * @param out Segment receiving the tokens
+ */
+inline void WidenPad(const uint8_t* bytes, size_t count, size_t prefix, size_t size, int32_t padding_token,
+                     uint16_t* out) {
+  const ByteKernels& kernels = SelectByteKernels();
+  uint16_t padding = static_cast<uint16_t>(padding_token);
+  size_t bytes_to_add = count < size - prefix ? count : size - prefix;
+  kernels.fill16(out, prefix, padding);
+  kernels.widen16(bytes, bytes_to_add, out + prefix);
+  kernels.fill16(out + prefix + bytes_to_add, size - prefix - bytes_to_add, padding);
+}
+
+#endif  // MAGIKACPP_BYTEKERNELS_H_
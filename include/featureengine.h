@@ -0,0 +1,515 @@
+#ifndef MAGIKACPP_FEATUREENGINE_H_
+#define MAGIKACPP_FEATUREENGINE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "config.h"
+#include "filefeatures.h"
+#include "bytekernels.h"
+#include "seekable.h"
+#include "fingerprint.h"
+
+/**
+ * The feature engine builds the features of one file from a byte source
+ * into a sink. Every extraction entry point (memory, mapping, Seekable,
+ * io_uring reads, streams) instantiates ExtractWithEngine with its own
+ * source, so trimming, padding and the segment layout live in one place and
+ * each source is inlined into its own specialized copy of the engine.
+ *
+ * A byte source provides:
+ *   size_t size() const;
+ *     Size of the file in bytes.
+ *   void Views(const FeatureWindows& windows, BlockViews& blocks);
+ *     Make the bytes of the planned windows available and point the views
+ *     at them: memory sources return pointers into the content, file
+ *     sources read the windows into a buffer first.
+ *
+ * A shape provides the feature sizes, see RuntimeShape.
+ *
+ * A sink provides:
+ *   void FirstBlock(const uint8_t* bytes, size_t count);
+ *     The untrimmed beginning block.
+ *   int32_t* Segment(FeatureSegment segment, size_t size);
+ *     Where to write the size tokens of a segment.
+ *   void Hash(const uint8_t* bytes, size_t count, size_t prefix, size_t size, int32_t padding_token);
+ *     Called once a segment is written, with the arguments of WidenPad,
+ *     to fingerprint the features in the same pass.
+ */
+
+/**
+ * FeatureWindows holds the byte windows of a file that features are built
+ * from. It only depends on the file size and the configuration.
+ */
+struct FeatureWindows {
+  size_t content_size;
+  size_t beg_count;
+  size_t mid_start;
+  size_t mid_count;
+  size_t end_start;
+  size_t end_count;
+  size_t offset_starts[4];
+  size_t offset_counts[4];
+};
+
+/**
+ * BlockViews holds views of the windows of a file, once made available by
+ * the byte source.
+ */
+struct BlockViews {
+  const uint8_t* beg_bytes;
+  size_t beg_count;
+  const uint8_t* mid_bytes;
+  size_t mid_count;
+  const uint8_t* end_bytes;
+  size_t end_count;
+  const uint8_t* offset_bytes[4];
+  size_t offset_counts[4];
+};
+
+/**
+ * FeatureSegment identifies a segment of the flattened features.
+ */
+enum class FeatureSegment { kBeg, kMid, kEnd, kOffset8000, kOffset8800, kOffset9000, kOffset9800 };
+
+/**
+ * RuntimeShape takes the feature sizes from the loaded configuration.
+ */
+struct RuntimeShape {
+  const Config& cfg;
+  
+  size_t beg_size() const { return static_cast<size_t>(cfg.beg_size); }
+  int mid_size() const { return cfg.mid_size; }
+  size_t end_size() const { return static_cast<size_t>(cfg.end_size); }
+  size_t block_size() const { return static_cast<size_t>(cfg.block_size); }
+  bool use_inputs_at_offsets() const { return cfg.use_inputs_at_offsets; }
+  int32_t padding_token() const { return cfg.padding_token; }
+};
+
+/**
+ * PlanFeatureWindows computes the windows of a file of the given size.
+ * @param content_size File size in bytes
+ * @param shape Feature sizes
+ * @param windows Planned windows
+ */
+template <typename Shape>
+inline void PlanFeatureWindows(size_t content_size, const Shape& shape, FeatureWindows& windows) {
+  windows.content_size = content_size;
+  
+  // Beginning and end blocks
+  size_t block_size = std::min(content_size, shape.block_size());
+  windows.beg_count = block_size;
+  windows.end_start = content_size - block_size;
+  windows.end_count = block_size;
+  
+  // Middle block, all the content when it is smaller than MID_SIZE
+  windows.mid_start = 0;
+  windows.mid_count = 0;
+  if (shape.mid_size() > 0) {
+    size_t mid_size = static_cast<size_t>(shape.mid_size());
+    windows.mid_count = content_size;
+    if (content_size > mid_size) {
+      windows.mid_start = (content_size - mid_size) / 2;
+      windows.mid_count = std::min(mid_size, content_size - windows.mid_start);
+    }
+  }
+  
+  // Offset windows, empty when the file ends before them
+  const size_t offsets[4] = { k_offset_8000, k_offset_8800, k_offset_9000, k_offset_9800 };
+  for (int i = 0; i < 4; i++) {
+    windows.offset_starts[i] = std::min(offsets[i], content_size);
+    windows.offset_counts[i] = 0;
+    if (shape.use_inputs_at_offsets() && content_size > offsets[i]) {
+      windows.offset_counts[i] = std::min(static_cast<size_t>(k_offset_size), content_size - offsets[i]);
+    }
+  }
+}
+
+/**
+ * PlanBlockReads computes one range per window of a file, laying the blocks
+ * out one after the other in the buffer: ranges[0] is the beg block,
+ * ranges[1] the mid block and ranges[2] the end block, followed by the
+ * offset windows that lie (at least partially) in the file.
+ * @param windows Planned windows
+ * @param reads Planned ranges and their buffers
+ * @param base_offset Offset of the content in the underlying file
+ */
+inline void PlanBlockReads(const FeatureWindows& windows, FeatureReads& reads, size_t base_offset) {
+  reads.content_size = windows.content_size;
+  reads.range_count = 0;
+  
+  reads.buffer.resize(windows.beg_count + windows.mid_count + windows.end_count);
+  uint8_t* beg_buffer = reads.buffer.data();
+  uint8_t* mid_buffer = beg_buffer + windows.beg_count;
+  uint8_t* end_buffer = mid_buffer + windows.mid_count;
+  reads.ranges[reads.range_count++] = { base_offset, windows.beg_count, beg_buffer };
+  reads.ranges[reads.range_count++] = { base_offset + windows.mid_start, windows.mid_count, mid_buffer };
+  reads.ranges[reads.range_count++] = { base_offset + windows.end_start, windows.end_count, end_buffer };
+  reads.beg_bytes = beg_buffer;
+  reads.beg_count = windows.beg_count;
+  reads.mid_bytes = mid_buffer;
+  reads.mid_count = windows.mid_count;
+  reads.end_bytes = end_buffer;
+  reads.end_count = windows.end_count;
+  
+  for (int i = 0; i < 4; i++) {
+    reads.offset_bytes[i] = reads.offset_buffer[i];
+    reads.offset_counts[i] = windows.offset_counts[i];
+    if (windows.offset_counts[i] > 0) {
+      reads.ranges[reads.range_count++] = { base_offset + windows.offset_starts[i], windows.offset_counts[i],
+                                            reads.offset_buffer[i] };
+    }
+  }
+}
+
+/**
+ * PlanWindowReads computes the ranges to read to get the given windows of a
+ * file, and sizes the buffer they are read into. When the beg and end
+ * blocks overlap or touch, the whole file is read with a single range and
+ * every block is a view of it, otherwise see PlanBlockReads.
+ * @param windows Planned windows
+ * @param reads Planned ranges and their buffers
+ * @param base_offset Offset of the content in the underlying file
+ */
+inline void PlanWindowReads(const FeatureWindows& windows, FeatureReads& reads, size_t base_offset) {
+  size_t content_size = windows.content_size;
+  if (windows.beg_count + windows.end_count < content_size) {
+    PlanBlockReads(windows, reads, base_offset);
+    return;
+  }
+  
+  reads.content_size = content_size;
+  reads.range_count = 0;
+  reads.buffer.resize(content_size);
+  reads.ranges[reads.range_count++] = { base_offset, content_size, reads.buffer.data() };
+  
+  const uint8_t* content = reads.buffer.data();
+  reads.beg_bytes = content;
+  reads.beg_count = windows.beg_count;
+  reads.mid_bytes = content + windows.mid_start;
+  reads.mid_count = windows.mid_count;
+  reads.end_bytes = content + windows.end_start;
+  reads.end_count = windows.end_count;
+  for (int i = 0; i < 4; i++) {
+    reads.offset_bytes[i] = content + windows.offset_starts[i];
+    reads.offset_counts[i] = windows.offset_counts[i];
+  }
+}
+
+/**
+ * TrimBlocks strips whitespace from the beg and end views and truncates them
+ * to their feature size. Only the view boundaries move, nothing is copied.
+ * @param blocks Views to trim
+ * @param shape Feature sizes
+ */
+template <typename Shape>
+inline void TrimBlocks(BlockViews& blocks, const Shape& shape) {
+  const ByteKernels& kernels = SelectByteKernels();
+  
+  // Remove leading whitespace characters and limit beg size
+  size_t skipped = kernels.skip_whitespace(blocks.beg_bytes, blocks.beg_count);
+  blocks.beg_bytes += skipped;
+  blocks.beg_count -= skipped;
+  blocks.beg_count = std::min(blocks.beg_count, shape.beg_size());
+  
+  // Remove trailing whitespace characters and limit end size, keeping the tail
+  blocks.end_count = kernels.trim_whitespace(blocks.end_bytes, blocks.end_count);
+  if (blocks.end_count > shape.end_size()) {
+    blocks.end_bytes += blocks.end_count - shape.end_size();
+    blocks.end_count = shape.end_size();
+  }
+}
+
+/**
+ * WriteSegment writes one segment of the features into the sink and lets
+ * the sink fingerprint it.
+ * @param sink Sink receiving the features
+ * @param segment Segment to write
+ * @param bytes Bytes of the segment
+ * @param count Number of bytes available
+ * @param prefix Number of leading padding tokens, at most size
+ * @param size Number of tokens in the segment
+ * @param padding_token Token used for padding
+ */
+template <typename Sink>
+inline void WriteSegment(Sink& sink, FeatureSegment segment, const uint8_t* bytes, size_t count, size_t prefix,
+                         size_t size, int32_t padding_token) {
+  WidenPad(bytes, count, prefix, size, padding_token, sink.Segment(segment, size));
+  sink.Hash(bytes, count, prefix, size, padding_token);
+}
+
+/**
+ * ExtractWithEngine builds the features of the source into the sink.
+ * @param source Byte source of the file
+ * @param shape Feature sizes
+ * @param sink Sink receiving the features
+ */
+template <typename Source, typename Shape, typename Sink>
+inline void ExtractWithEngine(Source& source, const Shape& shape, Sink& sink) {
+  FeatureWindows windows;
+  PlanFeatureWindows(source.size(), shape, windows);
+  BlockViews blocks;
+  source.Views(windows, blocks);
+  
+  sink.FirstBlock(blocks.beg_bytes, blocks.beg_count);
+  TrimBlocks(blocks, shape);
+  
+  // Beg is padded at the end, mid on both sides and end at the front
+  const int32_t padding_token = shape.padding_token();
+  WriteSegment(sink, FeatureSegment::kBeg, blocks.beg_bytes, blocks.beg_count, 0, shape.beg_size(), padding_token);
+  if (shape.mid_size() > 0) {
+    size_t mid_size = static_cast<size_t>(shape.mid_size());
+    WriteSegment(sink, FeatureSegment::kMid, blocks.mid_bytes, blocks.mid_count, (mid_size - blocks.mid_count) / 2,
+                 mid_size, padding_token);
+  }
+  WriteSegment(sink, FeatureSegment::kEnd, blocks.end_bytes, blocks.end_count, shape.end_size() - blocks.end_count,
+               shape.end_size(), padding_token);
+  
+  if (shape.use_inputs_at_offsets()) {
+    for (int i = 0; i < 4; i++) {
+      WriteSegment(sink, static_cast<FeatureSegment>(static_cast<int>(FeatureSegment::kOffset8000) + i),
+                   blocks.offset_bytes[i], blocks.offset_counts[i], 0, k_offset_size, padding_token);
+    }
+  }
+}
+
+/**
+ * MemorySource reads windows as views of content already in memory, from a
+ * buffer or a mapping, so nothing is copied.
+ */
+struct MemorySource {
+  const uint8_t* content;
+  size_t content_size;
+  
+  size_t size() const { return content_size; }
+  
+  void Views(const FeatureWindows& windows, BlockViews& blocks) {
+    blocks.beg_bytes = content;
+    blocks.beg_count = windows.beg_count;
+    blocks.mid_bytes = content + windows.mid_start;
+    blocks.mid_count = windows.mid_count;
+    blocks.end_bytes = content + windows.end_start;
+    blocks.end_count = windows.end_count;
+    for (int i = 0; i < 4; i++) {
+      blocks.offset_bytes[i] = content + windows.offset_starts[i];
+      blocks.offset_counts[i] = windows.offset_counts[i];
+    }
+  }
+};
+
+/**
+ * ReadsSource takes its windows from ranges planned by PlanFeatureReads and
+ * already read, for example by BatchReader.
+ */
+struct ReadsSource {
+  const FeatureReads& reads;
+  
+  size_t size() const { return reads.content_size; }
+  
+  void Views(const FeatureWindows&, BlockViews& blocks) {
+    blocks.beg_bytes = reads.beg_bytes;
+    blocks.beg_count = reads.beg_count;
+    blocks.mid_bytes = reads.mid_bytes;
+    blocks.mid_count = reads.mid_count;
+    blocks.end_bytes = reads.end_bytes;
+    blocks.end_count = reads.end_count;
+    for (int i = 0; i < 4; i++) {
+      blocks.offset_bytes[i] = reads.offset_bytes[i];
+      blocks.offset_counts[i] = reads.offset_counts[i];
+    }
+  }
+};
+
+/**
+ * SeekableSource reads only the windows from a file, with as few syscalls
+ * as the ranges allow, into a reusable FeatureReads.
+ */
+struct SeekableSource {
+  Seekable& seekable;
+  FeatureReads& reads;
+  
+  size_t size() const { return seekable.size(); }
+  
+  void Views(const FeatureWindows& windows, BlockViews& blocks) {
+    PlanWindowReads(windows, reads, 0);
+    seekable.read_ranges(reads.ranges, reads.range_count);
+    ReadsSource{ reads }.Views(windows, blocks);
+  }
+};
+
+/**
+ * AdaptiveSeekableSource reads only the bytes the features keep: beg_size
+ * bytes at the start and end_size bytes at the end of the file first, then
+ * extends each read only as far as leading or trailing whitespace eats into
+ * it, never beyond block_size. The trimmed blocks, and so the features, are
+ * the same as when reading whole blocks, but most files cost a quarter of
+ * the bytes. The untrimmed beginning block is cut short, so Features sinks,
+ * which keep it, use SeekableSource instead.
+ */
+struct AdaptiveSeekableSource {
+  Seekable& seekable;
+  FeatureReads& reads;
+  size_t beg_size;
+  size_t end_size;
+  
+  // The beg and end reads are never merged across more than a page, the
+  // bytes in between are what this source avoids reading
+  static const size_t kMaxGap = 4096;
+  
+  size_t size() const { return seekable.size(); }
+  
+  void Views(const FeatureWindows& windows, BlockViews& blocks) {
+    size_t content_size = windows.content_size;
+    size_t beg_have = std::min(windows.beg_count, beg_size);
+    size_t end_have = std::min(windows.end_count, end_size);
+    
+    // Small files are read whole, there is nothing to save
+    if (beg_have + end_have >= content_size) {
+      SeekableSource{ seekable, reads }.Views(windows, blocks);
+      return;
+    }
+    
+    // Plan the full windows so that the buffer can hold any extension, but
+    // read only the first and last bytes of the beg and end blocks. The end
+    // block is filled from the back of its slot.
+    PlanBlockReads(windows, reads, 0);
+    uint8_t* beg_buffer = reads.ranges[0].buffer;
+    uint8_t* end_buffer = reads.ranges[2].buffer;
+    reads.ranges[0].size = beg_have;
+    reads.ranges[2].offset = content_size - end_have;
+    reads.ranges[2].buffer = end_buffer + windows.end_count - end_have;
+    reads.ranges[2].size = end_have;
+    seekable.read_ranges(reads.ranges, reads.range_count, kMaxGap);
+    
+    const ByteKernels& kernels = SelectByteKernels();
+    
+    // Extend the beg block while leading whitespace leaves less than
+    // beg_size bytes after it
+    size_t skipped = 0;
+    for (;;) {
+      skipped += kernels.skip_whitespace(beg_buffer + skipped, beg_have - skipped);
+      size_t beg_need = std::min(windows.beg_count, skipped + beg_size);
+      if (beg_need <= beg_have) {
+        break;
+      }
+      seekable.read_into(beg_have, beg_buffer + beg_have, beg_need - beg_have);
+      beg_have = beg_need;
+    }
+    
+    // Extend the end block backwards in the same way for trailing whitespace
+    uint8_t* end_slot = end_buffer + windows.end_count;
+    size_t trailing = 0;
+    for (;;) {
+      size_t untrimmed = end_have - trailing;
+      trailing += untrimmed - kernels.trim_whitespace(end_slot - end_have, untrimmed);
+      size_t end_need = std::min(windows.end_count, trailing + end_size);
+      if (end_need <= end_have) {
+        break;
+      }
+      seekable.read_into(content_size - end_need, end_slot - end_need, end_need - end_have);
+      end_have = end_need;
+    }
+    
+    ReadsSource{ reads }.Views(windows, blocks);
+    blocks.beg_count = beg_have;
+    blocks.end_bytes = end_slot - end_have;
+    blocks.end_count = end_have;
+  }
+};
+
+/**
+ * BufferedSource takes its windows from buffers that already hold the
+ * beginning, the end and the offset windows of a file, as kept by a stream.
+ */
+struct BufferedSource {
+  size_t content_size;
+  const uint8_t* head;
+  size_t head_count;
+  const uint8_t* tail;
+  size_t tail_count;
+  const uint8_t (*offset_buffers)[k_offset_size];
+  
+  size_t size() const { return content_size; }
+  
+  void Views(const FeatureWindows& windows, BlockViews& blocks) {
+    blocks.beg_bytes = head;
+    blocks.beg_count = head_count;
+    blocks.mid_bytes = nullptr;
+    blocks.mid_count = 0;
+    blocks.end_bytes = tail;
+    blocks.end_count = tail_count;
+    for (int i = 0; i < 4; i++) {
+      blocks.offset_bytes[i] = offset_buffers[i];
+      blocks.offset_counts[i] = windows.offset_counts[i];
+    }
+  }
+};
+
+/**
+ * RowSink writes the flattened features straight into a tensor row of
+ * int32 (or uint16, see Row16Sink) tokens and fingerprints them on the way.
+ */
+template <typename Token>
+struct BasicRowSink {
+  const FeatureLayout& layout;
+  Token* row;
+  FeatureHasher hasher;
+  
+  BasicRowSink(const FeatureLayout& l, Token* r) : layout(l), row(r) {}
+  
+  void FirstBlock(const uint8_t*, size_t) {}
+  
+  void Hash(const uint8_t* bytes, size_t count, size_t prefix, size_t size, int32_t padding_token) {
+    hasher.Segment(bytes, count, prefix, size, padding_token);
+  }
+  
+  Token* Segment(FeatureSegment segment, size_t) {
+    switch (segment) {
+      case FeatureSegment::kBeg:
+        return row + layout.beg_offset;
+      case FeatureSegment::kMid:
+        return row + layout.mid_offset;
+      case FeatureSegment::kEnd:
+        return row + layout.end_offset;
+      default:
+        return row + layout.offset_offsets[static_cast<int>(segment) - static_cast<int>(FeatureSegment::kOffset8000)];
+    }
+  }
+};
+
+typedef BasicRowSink<int32_t> RowSink;
+typedef BasicRowSink<uint16_t> Row16Sink;
+
+/**
+ * FeaturesSink writes into the vectors of a Features, reusing their
+ * capacity. Segments the configuration does not use are left empty.
+ */
+struct FeaturesSink {
+  Features& features;
+  
+  explicit FeaturesSink(Features& f) : features(f) {
+    features.mid.clear();
+    features.offset_8000.clear();
+    features.offset_8800.clear();
+    features.offset_9000.clear();
+    features.offset_9800.clear();
+  }
+  
+  void FirstBlock(const uint8_t* bytes, size_t count) {
+    features.first_block.assign(bytes, bytes + count);
+  }
+  
+  int32_t* Segment(FeatureSegment segment, size_t size) {
+    std::vector<int32_t>* segments[] = {
+      &features.beg, &features.mid, &features.end,
+      &features.offset_8000, &features.offset_8800, &features.offset_9000, &features.offset_9800
+    };
+    std::vector<int32_t>& result = *segments[static_cast<int>(segment)];
+    result.resize(size);
+    return result.data();
+  }
+  
+  void Hash(const uint8_t*, size_t, size_t, size_t, int32_t) {}
+};
+
+#endif  // MAGIKACPP_FEATUREENGINE_H_
@@ -0,0 +1,114 @@
+#ifndef MAGIKACPP_FEATUREEXPORT_H_
+#define MAGIKACPP_FEATUREEXPORT_H_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "filefeatures.h"
+#include "seekable.h"
+
+// Size of the header of exported feature matrices, the rows start right
+// after it so that readers can skip it without parsing it
+const size_t k_feature_matrix_header_size = 128;
+
+/**
+ * FeatureExporter runs feature extraction only, over files added one by
+ * one, and streams the rows to a feature matrix in the .npy format (version
+ * 1.0, shape (rows, row_size), C order) plus a tab-separated index. The
+ * matrix can be memory-mapped by a separate inference stage, e.g. with
+ * MagikaScanner::scanFeatureMatrix or numpy.load(mmap_mode="r"), so that
+ * extraction runs next to the storage and inference elsewhere, and new
+ * models can be run over an old corpus without reading any file again.
+ *
+ * The index has one line per added file:
+ *   row<TAB>fingerprint<TAB>status<TAB>path
+ * where row is the row of the file in the matrix (-1 when it has none),
+ * fingerprint the hexadecimal FeatureHasher fingerprint of that row, and
+ * status "ok", "empty" for empty files, which the model does not run on,
+ * or the reason the file could not be read.
+ */
+class FeatureExporter {
+ private:
+  const Config& config;
+  FeatureLayout layout;
+  TokenType token_type;
+  ReadHints hints;
+  std::ofstream matrix;
+  std::ofstream index;
+  size_t row_count;
+  std::vector<int32_t> row;
+  std::vector<uint16_t> row16;
+  
+  void WriteHeader();
+  void WriteIndex(long long row_index, uint64_t fingerprint, const std::string& status, const std::string& filepath);
+  
+ public:
+  /**
+   * Constructor, creates or truncates the output files
+   * @param cfg Configuration parameters, must outlive the exporter
+   * @param matrix_path Path of the feature matrix, usually ending in .npy
+   * @param index_path Path of the index
+   * @param type Type of the stored tokens
+   * @param read_hints Access hints used to read the added files
+   * @throws std::runtime_error if an output file cannot be created or the
+   *         padding token does not fit in type
+   */
+  FeatureExporter(const Config& cfg, const std::string& matrix_path, const std::string& index_path,
+                  TokenType type = TokenType::kInt32, const ReadHints& read_hints = ReadHints());
+  
+  /**
+   * Destructor, closes the outputs if Close was not called
+   */
+  ~FeatureExporter();
+  
+  FeatureExporter(const FeatureExporter&) = delete;
+  FeatureExporter& operator=(const FeatureExporter&) = delete;
+  
+  /**
+   * Extract the features of a file and append them to the matrix. Files that
+   * cannot be read are only recorded in the index.
+   * @param filepath Path to the file
+   * @return True if a row was written
+   * @throws std::runtime_error if an output file cannot be written
+   */
+  bool Add(const std::string& filepath);
+  
+  /**
+   * Get the number of rows written so far
+   * @return Number of rows
+   */
+  size_t rows() const;
+  
+  /**
+   * Write the final shape into the matrix header and close the outputs
+   * @throws std::runtime_error if an output file cannot be written
+   */
+  void Close();
+};
+
+/**
+ * FeatureMatrix is a view of a feature matrix written by FeatureExporter.
+ */
+struct FeatureMatrix {
+  // First byte of the first row
+  const uint8_t* data;
+  TokenType token_type;
+  // Whether the tokens are in the other byte order than the host's
+  bool byte_swapped;
+  size_t rows;
+  size_t row_size;
+};
+
+/**
+ * ParseFeatureMatrix reads the header of a feature matrix.
+ * @param content Pointer to the matrix file content
+ * @param content_size Size of the content in bytes
+ * @param matrix View of the rows
+ * @throws std::runtime_error if the content is not a feature matrix or is
+ *         cut short
+ */
+void ParseFeatureMatrix(const uint8_t* content, size_t content_size, FeatureMatrix& matrix);
+
+#endif  // MAGIKACPP_FEATUREEXPORT_H_
@@ -10,6 +10,18 @@
 // Forward declaration
 class Seekable;
 
+// Configuration constants
+const int k_beg_size = 1024;
+const int k_mid_size = 0;
+const int k_end_size = 1024;
+const int k_padding_token = 256;
+const int k_block_size = 4096;
+const int k_offset_8000 = 0x8000;
+const int k_offset_8800 = 0x8800;
+const int k_offset_9000 = 0x9000;
+const int k_offset_9800 = 0x9800;
+const int k_offset_size = 8;
+
 /**
  * Features holds the features of a given slice of bytes.
  */
@@ -28,8 +40,48 @@ struct Features {
    * @return Flattened feature array
    */
   std::vector<int32_t> Flatten() const;
+  
+  /**
+   * FlattenInto writes the flattened features into result, reusing its
+   * capacity.
+   * @param result Flattened feature array
+   */
+  void FlattenInto(std::vector<int32_t>& result) const;
 };
 
+/**
+ * FeatureLayout holds where each feature segment starts in a flattened
+ * feature row, in the order used by Features::Flatten. It only depends on
+ * the configuration, so it is computed once per model.
+ */
+struct FeatureLayout {
+  size_t beg_offset = 0;
+  size_t mid_offset = 0;
+  size_t end_offset = 0;
+  // Segments of the 0x8000, 0x8800, 0x9000 and 0x9800 offset features
+  size_t offset_offsets[4] = { 0, 0, 0, 0 };
+  // Number of tokens in a row
+  size_t row_size = 0;
+};
+
+/**
+ * Type of the tokens of a feature row
+ */
+enum class TokenType {
+  // int32 tokens, the input type of the shipped models
+  kInt32,
+  // uint16 tokens, half the size; every token fits as long as the padding
+  // token does
+  kUInt16,
+};
+
+/**
+ * ComputeFeatureLayout computes the layout of a feature row.
+ * @param cfg Configuration parameters
+ * @return Feature row layout
+ */
+FeatureLayout ComputeFeatureLayout(const Config& cfg);
+
 /**
  * ExtractFeatures extract the features from the given content.
  * @param content File content as byte vector
@@ -38,6 +90,53 @@ struct Features {
  */
 Features ExtractFeatures(const std::vector<uint8_t>& content, const Config& cfg);
 
+/**
+ * ExtractFeatures extract the features from a view of the given content,
+ * without copying it.
+ * @param content Pointer to the file content
+ * @param content_size Size of the content in bytes
+ * @param cfg Configuration parameters
+ * @return Extracted features
+ */
+Features ExtractFeatures(const uint8_t* content, size_t content_size, const Config& cfg);
+
+/**
+ * ExtractFeatures extract the features from a view of the given content into
+ * an existing Features, reusing the capacity of its vectors.
+ * @param content Pointer to the file content
+ * @param content_size Size of the content in bytes
+ * @param cfg Configuration parameters
+ * @param features Extracted features
+ */
+void ExtractFeatures(const uint8_t* content, size_t content_size, const Config& cfg, Features& features);
+
+/**
+ * ExtractFeatures writes the flattened features of a view of the given
+ * content straight into a row of an input tensor, skipping the Features
+ * vectors and the Flatten copy.
+ * @param content Pointer to the file content
+ * @param content_size Size of the content in bytes
+ * @param cfg Configuration parameters
+ * @param layout Layout computed from cfg
+ * @param row Row receiving layout.row_size tokens
+ * @return Fingerprint of the row, see FeatureHasher
+ */
+uint64_t ExtractFeatures(const uint8_t* content, size_t content_size, const Config& cfg, const FeatureLayout& layout,
+                     int32_t* row);
+
+/**
+ * ExtractFeatures writes the flattened features straight into a row of
+ * uint16 tokens.
+ * @param content Pointer to the file content
+ * @param content_size Size of the content in bytes
+ * @param cfg Configuration parameters
+ * @param layout Layout computed from cfg
+ * @param row Row receiving layout.row_size tokens
+ * @return Fingerprint of the row, see FeatureHasher
+ */
+uint64_t ExtractFeatures(const uint8_t* content, size_t content_size, const Config& cfg, const FeatureLayout& layout,
+                         uint16_t* row);
+
 /**
  * ExtractFeaturesFromSeekable extract the features from a seekable object.
  * @param seekable Seekable object to extract features from
@@ -46,16 +145,189 @@ Features ExtractFeatures(const std::vector<uint8_t>& content, const Config& cfg)
  */
 Features ExtractFeaturesFromSeekable(Seekable& seekable, const Config& cfg);
 
-// Configuration constants
-const int k_beg_size = 1024;
-const int k_mid_size = 0;
-const int k_end_size = 1024;
-const int k_padding_token = 256;
-const int k_block_size = 4096;
-const int k_offset_8000 = 0x8000;
-const int k_offset_8800 = 0x8800;
-const int k_offset_9000 = 0x9000;
-const int k_offset_9800 = 0x9800;
-const int k_offset_size = 8;
+/**
+ * ExtractFeaturesFromSeekable extract the features from a seekable object
+ * into an existing Features. Reads go to a per-thread scratch buffer and the
+ * capacity of the feature vectors is reused, so once warmed up no heap
+ * allocation happens per file.
+ * @param seekable Seekable object to extract features from
+ * @param cfg Configuration parameters
+ * @param features Extracted features
+ */
+void ExtractFeaturesFromSeekable(Seekable& seekable, const Config& cfg, Features& features);
+
+/**
+ * ExtractFeaturesFromSeekable writes the flattened features of a seekable
+ * object straight into a row of an input tensor.
+ * @param seekable Seekable object to extract features from
+ * @param cfg Configuration parameters
+ * @param layout Layout computed from cfg
+ * @param row Row receiving layout.row_size tokens
+ * @return Fingerprint of the row, see FeatureHasher
+ */
+uint64_t ExtractFeaturesFromSeekable(Seekable& seekable, const Config& cfg, const FeatureLayout& layout, int32_t* row);
+
+/**
+ * ExtractFeaturesFromSeekable writes the flattened features of a seekable
+ * object straight into a row of uint16 tokens.
+ * @param seekable Seekable object to extract features from
+ * @param cfg Configuration parameters
+ * @param layout Layout computed from cfg
+ * @param row Row receiving layout.row_size tokens
+ * @return Fingerprint of the row, see FeatureHasher
+ */
+uint64_t ExtractFeaturesFromSeekable(Seekable& seekable, const Config& cfg, const FeatureLayout& layout, uint16_t* row);
+
+/**
+ * FeatureReads holds the ranges of a file that feature extraction needs,
+ * the buffer they are read into and views of the blocks inside it. The
+ * ranges and views point into the same object, so it must not be copied
+ * once planned.
+ */
+struct FeatureReads {
+  size_t content_size = 0;
+  // Storage the ranges are read into
+  std::vector<uint8_t> buffer;
+  uint8_t offset_buffer[4][k_offset_size];
+  // Views of the blocks, valid once the ranges have been read
+  const uint8_t* beg_bytes = nullptr;
+  size_t beg_count = 0;
+  const uint8_t* mid_bytes = nullptr;
+  size_t mid_count = 0;
+  const uint8_t* end_bytes = nullptr;
+  size_t end_count = 0;
+  const uint8_t* offset_bytes[4] = { nullptr, nullptr, nullptr, nullptr };
+  size_t offset_counts[4] = { 0, 0, 0, 0 };
+  ReadRange ranges[7];
+  size_t range_count = 0;
+};
+
+/**
+ * PlanFeatureReads computes the ranges needed to extract the features of a
+ * file of the given size, and sizes the buffer they are read into. Files no
+ * larger than two blocks are read whole with a single range, the blocks
+ * then being views of that one read.
+ * @param content_size File size in bytes
+ * @param cfg Configuration parameters
+ * @param reads Planned ranges and their buffers
+ * @param base_offset Offset of the content in the underlying file, to treat
+ *        a range of a larger file as a virtual file
+ */
+void PlanFeatureReads(size_t content_size, const Config& cfg, FeatureReads& reads, size_t base_offset = 0);
+
+/**
+ * ExtractFeaturesFromReads extract the features once all the planned ranges
+ * have been read.
+ * @param reads Ranges planned by PlanFeatureReads, with their buffers filled
+ * @param cfg Configuration parameters
+ * @return Extracted features
+ */
+Features ExtractFeaturesFromReads(const FeatureReads& reads, const Config& cfg);
+
+/**
+ * ExtractFeaturesFromReads extract the features into an existing Features,
+ * reusing the capacity of its vectors.
+ * @param reads Ranges planned by PlanFeatureReads, with their buffers filled
+ * @param cfg Configuration parameters
+ * @param features Extracted features
+ */
+void ExtractFeaturesFromReads(const FeatureReads& reads, const Config& cfg, Features& features);
+
+/**
+ * ExtractFeaturesFromReads writes the flattened features straight into a
+ * row of an input tensor once all the planned ranges have been read.
+ * @param reads Ranges planned by PlanFeatureReads, with their buffers filled
+ * @param cfg Configuration parameters
+ * @param layout Layout computed from cfg
+ * @param row Row receiving layout.row_size tokens
+ * @return Fingerprint of the row, see FeatureHasher
+ */
+uint64_t ExtractFeaturesFromReads(const FeatureReads& reads, const Config& cfg, const FeatureLayout& layout,
+                              int32_t* row);
+
+/**
+ * ExtractFeaturesFromReads writes the flattened features straight into a
+ * row of uint16 tokens once all the planned ranges have been read.
+ * @param reads Ranges planned by PlanFeatureReads, with their buffers filled
+ * @param cfg Configuration parameters
+ * @param layout Layout computed from cfg
+ * @param row Row receiving layout.row_size tokens
+ * @return Fingerprint of the row, see FeatureHasher
+ */
+uint64_t ExtractFeaturesFromReads(const FeatureReads& reads, const Config& cfg, const FeatureLayout& layout,
+                                  uint16_t* row);
+
+/**
+ * FeatureStream accumulates the bytes feature extraction needs from a stream
+ * whose size is not known in advance (pipes, sockets, stdin). It only keeps
+ * the first block_size bytes, a ring buffer of the last block_size bytes and
+ * the bytes at the offsets, so memory stays bounded whatever the stream
+ * size. Mid features need the stream size and are not supported.
+ */
+class FeatureStream {
+ private:
+  const Config& config;
+  size_t block_size;
+  size_t total_size;
+  std::vector<uint8_t> head;
+  // Ring buffer of the last block_size bytes, tail_pos is the next write
+  std::vector<uint8_t> tail;
+  size_t tail_pos;
+  // Tail in stream order, built by Finish
+  std::vector<uint8_t> end_bytes;
+  uint8_t offset_buffer[4][k_offset_size];
+  
+  void LayoutTail();
+  
+ public:
+  /**
+   * Constructor
+   * @param cfg Configuration parameters, must outlive the stream
+   * @throws std::runtime_error if the configuration uses mid features
+   */
+  explicit FeatureStream(const Config& cfg);
+  
+  /**
+   * Push the next chunk of the stream
+   * @param data Pointer to the chunk
+   * @param size Size of the chunk in bytes
+   */
+  void Push(const uint8_t* data, size_t size);
+  
+  /**
+   * Get the number of bytes pushed so far
+   * @return Stream size in bytes
+   */
+  size_t size() const;
+  
+  /**
+   * Extract the features of the bytes pushed so far
+   * @param features Extracted features
+   */
+  void Finish(Features& features);
+  
+  /**
+   * Write the flattened features of the bytes pushed so far straight into
+   * a row of an input tensor
+   * @param layout Layout computed from the configuration
+   * @param row Row receiving layout.row_size tokens
+   * @return Fingerprint of the row, see FeatureHasher
+   */
+  uint64_t Finish(const FeatureLayout& layout, int32_t* row);
+  
+  /**
+   * Write the flattened features of the bytes pushed so far straight into
+   * a row of uint16 tokens
+   * @param layout Layout computed from the configuration
+   * @param row Row receiving layout.row_size tokens
+   * @return Fingerprint of the row, see FeatureHasher
+   */
+  uint64_t Finish(const FeatureLayout& layout, uint16_t* row);
+  
+  /**
+   * Forget the bytes pushed so far, to start a new stream
+   */
+  void Reset();
+};
 
 #endif  // MAGIKACPP_FEATURES_H_
\ No newline at end of file
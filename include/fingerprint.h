@@ -0,0 +1,203 @@
+#ifndef MAGIKACPP_FINGERPRINT_H_
+#define MAGIKACPP_FINGERPRINT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * FeatureHasher computes a 64-bit fingerprint of flattened features while
+ * they are built, so that results can be cached and deduplicated by the
+ * exact model input without hashing the tensor row again.
+ *
+ * The fingerprint is the XXH64 hash (seed 0) of a compact encoding of the
+ * segments, which is a function of their tokens: for each segment, a header
+ * of four 32-bit words (size, prefix, count, padding token) followed by the
+ * count bytes between the prefix and suffix padding. When the padding token
+ * is itself a byte value (e.g. a configuration padding with 0) the padding
+ * cannot be told apart from the content, so the segment is encoded as size
+ * bytes with no padding instead. Equal rows of a given model thus always
+ * have equal fingerprints. Words are encoded and read little-endian as in
+ * the reference XXH64, so fingerprints do not depend on the host.
+ */
+class FeatureHasher {
+ private:
+  static const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+  static const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+  static const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+  static const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+  static const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+  
+  uint64_t acc[4];
+  uint64_t total_size;
+  uint8_t stripe[32];
+  size_t stripe_size;
+  
+  static uint64_t Rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+  
+  // Little-endian loads, compiled to plain loads on little-endian hosts
+  static uint32_t Read32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) |
+           (static_cast<uint32_t>(p[3]) << 24);
+  }
+  
+  static uint64_t Read64(const uint8_t* p) {
+    return static_cast<uint64_t>(Read32(p)) | (static_cast<uint64_t>(Read32(p + 4)) << 32);
+  }
+  
+  // UpdateHeader hashes the four words of a segment header, little-endian
+  void UpdateHeader(uint32_t size, uint32_t prefix, uint32_t count, uint32_t padding) {
+    const uint32_t words[4] = { size, prefix, count, padding };
+    uint8_t header[16];
+    for (int i = 0; i < 4; i++) {
+      header[i * 4] = static_cast<uint8_t>(words[i]);
+      header[i * 4 + 1] = static_cast<uint8_t>(words[i] >> 8);
+      header[i * 4 + 2] = static_cast<uint8_t>(words[i] >> 16);
+      header[i * 4 + 3] = static_cast<uint8_t>(words[i] >> 24);
+    }
+    Update(header, sizeof(header));
+  }
+  
+  static uint64_t Round(uint64_t a, uint64_t input) {
+    a += input * kPrime2;
+    a = Rotl(a, 31);
+    return a * kPrime1;
+  }
+  
+  static uint64_t MergeRound(uint64_t h, uint64_t a) {
+    h ^= Round(0, a);
+    return h * kPrime1 + kPrime4;
+  }
+  
+  void Consume(const uint8_t* p) {
+    acc[0] = Round(acc[0], Read64(p));
+    acc[1] = Round(acc[1], Read64(p + 8));
+    acc[2] = Round(acc[2], Read64(p + 16));
+    acc[3] = Round(acc[3], Read64(p + 24));
+  }
+  
+  void UpdateRun(uint8_t value, size_t count) {
+    uint8_t run[64];
+    std::memset(run, value, sizeof(run));
+    while (count > 0) {
+      size_t n = count < sizeof(run) ? count : sizeof(run);
+      Update(run, n);
+      count -= n;
+    }
+  }
+  
+ public:
+  FeatureHasher() {
+    acc[0] = kPrime1 + kPrime2;
+    acc[1] = kPrime2;
+    acc[2] = 0;
+    acc[3] = 0 - kPrime1;
+    total_size = 0;
+    stripe_size = 0;
+  }
+  
+  /**
+   * Update hashes the next bytes of the input
+   * @param data Pointer to the bytes
+   * @param size Number of bytes
+   */
+  void Update(const void* data, size_t size) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    total_size += size;
+  
+    // Complete the pending stripe first
+    if (stripe_size > 0) {
+      size_t n = 32 - stripe_size < size ? 32 - stripe_size : size;
+      if (n > 0) {
+        std::memcpy(stripe + stripe_size, p, n);
+      }
+      stripe_size += n;
+      p += n;
+      size -= n;
+      if (stripe_size < 32) {
+        return;
+      }
+      Consume(stripe);
+      stripe_size = 0;
+    }
+  
+    for (; size >= 32; p += 32, size -= 32) {
+      Consume(p);
+    }
+    if (size > 0) {
+      std::memcpy(stripe, p, size);
+    }
+    stripe_size = size;
+  }
+  
+  /**
+   * Segment hashes one feature segment, from the arguments WidenPad built it
+   * from
+   * @param bytes Bytes of the segment
+   * @param count Number of bytes available
+   * @param prefix Number of leading padding tokens, at most size
+   * @param size Number of tokens in the segment
+   * @param padding_token Token used for padding
+   */
+  void Segment(const uint8_t* bytes, size_t count, size_t prefix, size_t size, int32_t padding_token) {
+    size_t bytes_to_add = count < size - prefix ? count : size - prefix;
+    size_t suffix = size - prefix - bytes_to_add;
+  
+    if (padding_token >= 0 && padding_token <= 0xff && (prefix > 0 || suffix > 0)) {
+      // Padding looks like content, hash every token as a byte
+      UpdateHeader(static_cast<uint32_t>(size), 0, static_cast<uint32_t>(size), 0xffffffffu);
+      UpdateRun(static_cast<uint8_t>(padding_token), prefix);
+      Update(bytes, bytes_to_add);
+      UpdateRun(static_cast<uint8_t>(padding_token), suffix);
+      return;
+    }
+  
+    UpdateHeader(static_cast<uint32_t>(size), static_cast<uint32_t>(prefix), static_cast<uint32_t>(bytes_to_add),
+                 bytes_to_add == size ? 0xffffffffu : static_cast<uint32_t>(padding_token));
+    Update(bytes, bytes_to_add);
+  }
+  
+  /**
+   * Digest returns the fingerprint of everything hashed so far
+   * @return 64-bit fingerprint
+   */
+  uint64_t Digest() const {
+    uint64_t h;
+    if (total_size >= 32) {
+      h = Rotl(acc[0], 1) + Rotl(acc[1], 7) + Rotl(acc[2], 12) + Rotl(acc[3], 18);
+      h = MergeRound(h, acc[0]);
+      h = MergeRound(h, acc[1]);
+      h = MergeRound(h, acc[2]);
+      h = MergeRound(h, acc[3]);
+    } else {
+      h = kPrime5;
+    }
+    h += total_size;
+  
+    const uint8_t* p = stripe;
+    size_t size = stripe_size;
+    for (; size >= 8; p += 8, size -= 8) {
+      h ^= Round(0, Read64(p));
+      h = Rotl(h, 27) * kPrime1 + kPrime4;
+    }
+    if (size >= 4) {
+      h ^= static_cast<uint64_t>(Read32(p)) * kPrime1;
+      h = Rotl(h, 23) * kPrime2 + kPrime3;
+      p += 4;
+      size -= 4;
+    }
+    for (; size > 0; p++, size--) {
+      h ^= (*p) * kPrime5;
+      h = Rotl(h, 11) * kPrime1;
+    }
+  
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+  }
+};
+
+#endif  // MAGIKACPP_FINGERPRINT_H_
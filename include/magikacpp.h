@@ -5,6 +5,9 @@
 #include <utility>
 #include <stdexcept>
 #include <memory>
+#include <vector>
+#include <future>
+#include <cstdint>
 
 /**
  * Exception thrown when there is an error scanning a file
@@ -14,6 +17,157 @@ class MagikaException : public std::runtime_error {
   explicit MagikaException(const std::string& message) : std::runtime_error(message) {}
 };
 
+class FeatureStream;
+class BatchScheduler;
+
+/**
+ * Backend used to read the files being scanned
+ */
+enum class ReaderBackend {
+  // Positional reads of the beg/mid/end blocks through Seekable
+  kSeekable,
+  // Read-only memory mapping through MappedSeekable, features are built
+  // straight from the mapped pages without intermediate copies. A file
+  // found resized after mapping is read with Seekable instead, but one
+  // truncated while its features are built raises SIGBUS: do not use it on
+  // files other processes may truncate during the scan
+  kMapped,
+  // io_uring batches for scanFiles on Linux, each file is read through
+  // Seekable when io_uring is not available and for single file scans
+  kIoUring,
+};
+
+/**
+ * Options controlling how files are read while scanning
+ */
+struct ReaderOptions {
+  ReaderBackend backend = ReaderBackend::kSeekable;
+  // Maximum number of files in flight with the kIoUring backend
+  unsigned io_uring_queue_depth = 256;
+  // Disable kernel readahead on scanned files, only a few blocks are read.
+  // Not applied to descriptors passed to scanFd, scanFds and scanRanges:
+  // the hint is set on the open file, which the caller keeps reading
+  bool random_access = true;
+  // Drop the pages of scanned files from the page cache once read, so that
+  // sweeping a disk does not evict the cache of other services
+  bool drop_cache = false;
+  // Open scanned files with O_NOATIME where permitted
+  bool no_atime = false;
+  // Read scanned files with O_DIRECT, bypassing the page cache entirely for
+  // cold storage sweeps. Files are read through Seekable whatever the
+  // backend, and through the page cache where the filesystem rejects it
+  bool direct_io = false;
+};
+
+/**
+ * How ONNX Runtime runs the operators of the model
+ */
+enum class OperatorExecution {
+  // One operator after the other, each using the intra-op threads
+  kSequential,
+  // Independent branches of the graph at once on the inter-op threads
+  kParallel,
+};
+
+/**
+ * Options of MagikaScanner
+ */
+struct ScannerOptions {
+  ReaderOptions reader;
+  // Maximum number of inputs passed to the model in one run by the APIs
+  // scanning many inputs, whose features are built into one {B, N} tensor.
+  // Batching saves the per-run overhead but the model is compute bound on
+  // a single thread, so measure examples/bench_batch on the target machine
+  // before raising it
+  size_t batch_size = 1;
+  // Number of ONNX Runtime sessions scans run on. Concurrent scans share
+  // one session safely; with several, each scan runs on one of them in
+  // turn. The sessions share their prepacked weights and one memory arena,
+  // so each extra session costs little memory
+  size_t sessions = 1;
+  
+  // ONNX Runtime settings. Low-latency services scanning one input at a
+  // time want a few intra-op threads that spin; large-batch offline jobs
+  // want every core and no spinning between batches
+  
+  // Threads splitting the work of each operator, 0 for one per core
+  int intra_op_threads = 1;
+  // Threads running independent operators with kParallel, 0 for one per
+  // core
+  int inter_op_threads = 0;
+  OperatorExecution execution_mode = OperatorExecution::kSequential;
+  // Let idle threads of the pools spin waiting for work, which lowers the
+  // latency of the next run at the cost of CPU time
+  bool allow_spinning = true;
+  // Allocate intermediate tensors from a memory arena shared by the
+  // sessions rather than from the system allocator
+  bool cpu_arena = true;
+  // Plan the intermediate tensors of a run from the previous runs with the
+  // same input shape
+  bool mem_pattern = true;
+  // Run every session on thread pools of the ONNX Runtime environment,
+  // sized by the thread counts above, instead of pools of its own. The
+  // environment is created by the first scanner of the process and lives
+  // as long as a scanner does
+  bool global_thread_pools = false;
+};
+
+/**
+ * View of an in-memory buffer, which must stay alive while it is scanned
+ */
+struct BufferView {
+  const uint8_t* data;
+  size_t size;
+};
+
+/**
+ * Options of MagikaBatchScheduler
+ */
+struct BatchSchedulerOptions {
+  // Number of queued inputs that triggers a run of the model
+  size_t max_batch = 32;
+  // Longest time an input waits for others before a smaller batch is run
+  unsigned max_wait_us = 1000;
+};
+
+/**
+ * Counters of MagikaBatchScheduler since it was created
+ */
+struct BatchSchedulerStats {
+  // Number of runs of the model, and of inputs over all of them
+  uint64_t batches = 0;
+  uint64_t requests = 0;
+  // Runs triggered by max_batch rather than max_wait_us
+  uint64_t full_batches = 0;
+  size_t max_batch_size = 0;
+  // Time inputs spent queued before their batch was run, in microseconds
+  uint64_t total_queue_wait_us = 0;
+  uint64_t max_queue_wait_us = 0;
+};
+
+/**
+ * Range of bytes inside a larger file, scanned as if it were a file
+ */
+struct ByteRange {
+  size_t offset;
+  size_t length;
+};
+
+/**
+ * Result of scanning one file
+ */
+struct ScanResult {
+  std::string label;
+  float score = 0.0f;
+  // Empty on success, otherwise the reason the file could not be scanned
+  std::string error;
+  // 64-bit XXH64-based fingerprint of the exact model input, computed while
+  // the features are built. Files with the same features for a given model
+  // have the same fingerprint, so it can key a cache of results or
+  // deduplicate files before inference. 0 for empty files and errors.
+  uint64_t fingerprint = 0;
+};
+
 /**
  * Simple C++ wrapper for Magika file type detection
  */
@@ -25,6 +179,22 @@ class MagikaScanner {
    */
   static void initialize(const std::string& model_path);
   
+  /**
+   * Initialize the MagikaScanner with the path to the ONNX model and the
+   * options used to read the scanned files
+   * @param model_path Path to the model.onnx file
+   * @param reader_options File reading options
+   */
+  static void initialize(const std::string& model_path, const ReaderOptions& reader_options);
+  
+  /**
+   * Initialize the MagikaScanner with the path to the ONNX model and the
+   * scanner options
+   * @param model_path Path to the model.onnx file
+   * @param options Scanner options
+   */
+  static void initialize(const std::string& model_path, const ScannerOptions& options);
+  
   /**
    * Scan a file and return its content type
    * @param filepath Path to the file to scan
@@ -40,6 +210,256 @@ class MagikaScanner {
    * @throws MagikaException if there is an error scanning the file
    */
   static std::pair<std::string, float> scanFileWithScore(const std::string& filepath);
+  
+  /**
+   * Scan a file and return its content type, confidence score and feature
+   * fingerprint
+   * @param filepath Path to the file to scan
+   * @return Result of the scan, its error is always empty
+   * @throws MagikaException if there is an error scanning the file
+   */
+  static ScanResult scanFileWithFingerprint(const std::string& filepath);
+  
+  /**
+   * Scan many files and return their content types with confidence scores.
+   * The model runs once per batch_size files
+   * @param filepaths Paths to the files to scan
+   * @return One result per file, in the same order; a file that cannot be
+   *         scanned has its error set instead of throwing
+   * @throws MagikaException if the scanner is not initialized
+   */
+  static std::vector<ScanResult> scanFiles(const std::vector<std::string>& filepaths);
+  
+  /**
+   * Scan a range of bytes inside a file, e.g. a region carved from a disk
+   * image, as if it were a file of its own
+   * @param filepath Path to the file containing the range
+   * @param offset Offset of the range in the file
+   * @param length Length of the range in bytes
+   * @return Pair of content type and confidence score
+   * @throws MagikaException if the range exceeds the file or cannot be read
+   */
+  static std::pair<std::string, float> scanRange(const std::string& filepath, size_t offset, size_t length);
+  
+  /**
+   * Scan many ranges of bytes inside one file. The file is opened once and
+   * the ranges are read in file order, several at a time
+   * @param filepath Path to the file containing the ranges
+   * @param ranges Ranges to scan
+   * @return One result per range, in the same order; a range that cannot be
+   *         scanned has its error set instead of throwing
+   * @throws MagikaException if the file cannot be opened
+   */
+  static std::vector<ScanResult> scanRanges(const std::string& filepath, const std::vector<ByteRange>& ranges);
+  
+  /**
+   * Run the model over every row of a feature matrix written by
+   * FeatureExporter, without reading the original files. The matrix is
+   * memory-mapped and its rows are passed to the model batch_size at a
+   * time, converted when they were exported for the other input type.
+   * @param matrix_path Path to the feature matrix
+   * @return One result per row, in row order; fingerprints are left to 0,
+   *         they are in the index written next to the matrix
+   * @throws MagikaException if the matrix cannot be read or its rows do not
+   *         match the model
+   */
+  static std::vector<ScanResult> scanFeatureMatrix(const std::string& matrix_path);
+  
+#ifndef _WIN32
+  /**
+   * Scan an open file descriptor and return its content type. The size is
+   * taken with fstat and all reads are positional: the descriptor's file
+   * offset is left untouched and it is not closed. Only regular files can
+   * be scanned, pipes, sockets and devices have no size to plan reads
+   * from; push them through MagikaStreamScanner instead.
+   * ReaderOptions::random_access is not applied to the caller's descriptor.
+   * @param fd Open file descriptor
+   * @return String representation of the detected content type
+   * @throws MagikaException if there is an error scanning the file or the
+   *         descriptor is not a regular file
+   */
+  static std::string scanFd(int fd);
+  
+  /**
+   * Scan an open file descriptor and return its content type with
+   * confidence score, see scanFd
+   * @param fd Open file descriptor
+   * @return Pair of content type and confidence score
+   * @throws MagikaException if there is an error scanning the file
+   */
+  static std::pair<std::string, float> scanFdWithScore(int fd);
+  
+  /**
+   * Scan many open file descriptors, see scanFiles and scanFd
+   * @param fds Open file descriptors
+   * @return One result per descriptor, in the same order; a descriptor that
+   *         cannot be scanned has its error set instead of throwing
+   * @throws MagikaException if the scanner is not initialized
+   */
+  static std::vector<ScanResult> scanFds(const std::vector<int>& fds);
+  
+  /**
+   * Scan a range of bytes inside an open file descriptor, see scanRange.
+   * The descriptor's file offset is left untouched and it is not closed.
+   * @param fd Open file descriptor
+   * @param offset Offset of the range in the file
+   * @param length Length of the range in bytes
+   * @return Pair of content type and confidence score
+   * @throws MagikaException if the range exceeds the file or cannot be read
+   */
+  static std::pair<std::string, float> scanRange(int fd, size_t offset, size_t length);
+  
+  /**
+   * Scan many ranges of bytes inside an open file descriptor, see scanRanges
+   * @param fd Open file descriptor
+   * @param ranges Ranges to scan
+   * @return One result per range, in the same order
+   * @throws MagikaException if the descriptor cannot be used
+   */
+  static std::vector<ScanResult> scanRanges(int fd, const std::vector<ByteRange>& ranges);
+#endif
+  
+  /**
+   * Scan an in-memory buffer and return its content type. The buffer is
+   * neither copied nor written to the filesystem.
+   * @param data Pointer to the buffer content
+   * @param size Size of the buffer in bytes
+   * @return String representation of the detected content type
+   * @throws MagikaException if the scanner is not initialized
+   */
+  static std::string scanBuffer(const uint8_t* data, size_t size);
+  
+  /**
+   * Scan an in-memory buffer and return its content type with confidence score
+   * @param data Pointer to the buffer content
+   * @param size Size of the buffer in bytes
+   * @return Pair of content type and confidence score
+   * @throws MagikaException if the scanner is not initialized
+   */
+  static std::pair<std::string, float> scanBufferWithScore(const uint8_t* data, size_t size);
+  
+  /**
+   * Scan an in-memory buffer and return its content type with confidence score
+   * @param buffer Buffer content
+   * @return Pair of content type and confidence score
+   * @throws MagikaException if the scanner is not initialized
+   */
+  static std::pair<std::string, float> scanBufferWithScore(const std::vector<uint8_t>& buffer);
+  
+  /**
+   * Scan an in-memory buffer and return its content type, confidence score
+   * and feature fingerprint
+   * @param data Pointer to the buffer content
+   * @param size Size of the buffer in bytes
+   * @return Result of the scan, its error is always empty
+   * @throws MagikaException if the scanner is not initialized
+   */
+  static ScanResult scanBufferWithFingerprint(const uint8_t* data, size_t size);
+  
+  /**
+   * Scan many in-memory buffers, see scanFiles
+   * @param buffers Buffers to scan
+   * @return One result per buffer, in the same order; a buffer that cannot
+   *         be scanned has its error set instead of throwing
+   * @throws MagikaException if the scanner is not initialized
+   */
+  static std::vector<ScanResult> scanBuffers(const std::vector<BufferView>& buffers);
+};
+
+/**
+ * Incremental classifier for non-seekable streams (pipes, FIFOs, stdin,
+ * sockets). Callers push the stream chunk by chunk and then call finish().
+ * Only the first and last block_size bytes are kept, so memory stays
+ * bounded whatever the stream size. Models using mid features are not
+ * supported, as these need the stream size up front.
+ */
+class MagikaStreamScanner {
+ private:
+  std::unique_ptr<FeatureStream> stream;
+  
+ public:
+  /**
+   * Constructor, MagikaScanner must have been initialized and must not be
+   * initialized again while the stream scanner is alive
+   * @throws MagikaException if the scanner is not initialized or the model
+   *         cannot be used on streams
+   */
+  MagikaStreamScanner();
+  
+  /**
+   * Destructor
+   */
+  ~MagikaStreamScanner();
+  
+  MagikaStreamScanner(const MagikaStreamScanner&) = delete;
+  MagikaStreamScanner& operator=(const MagikaStreamScanner&) = delete;
+  
+  /**
+   * Push the next chunk of the stream
+   * @param data Pointer to the chunk
+   * @param size Size of the chunk in bytes
+   */
+  void push(const uint8_t* data, size_t size);
+  
+  /**
+   * Classify the bytes pushed so far and reset the scanner, so that it can
+   * be reused for the next stream
+   * @return Pair of content type and confidence score
+   */
+  std::pair<std::string, float> finish();
+};
+
+/**
+ * Scheduler coalescing single inputs scanned concurrently by many threads
+ * into batched runs of the model. The features of each input are built in
+ * the calling thread; a worker thread runs the queued inputs once
+ * max_batch of them are queued or the oldest has waited max_wait_us, and
+ * fulfills the future of each caller.
+ */
+class MagikaBatchScheduler {
+ private:
+  std::unique_ptr<BatchScheduler> scheduler;
+  
+ public:
+  /**
+   * Constructor, MagikaScanner must have been initialized and must not be
+   * initialized again while the scheduler is alive
+   * @param options Scheduler options
+   * @throws MagikaException if the scanner is not initialized
+   */
+  explicit MagikaBatchScheduler(const BatchSchedulerOptions& options = BatchSchedulerOptions());
+  
+  /**
+   * Destructor, runs the inputs still queued before returning
+   */
+  ~MagikaBatchScheduler();
+  
+  MagikaBatchScheduler(const MagikaBatchScheduler&) = delete;
+  MagikaBatchScheduler& operator=(const MagikaBatchScheduler&) = delete;
+  
+  /**
+   * Scan a file in the next batch
+   * @param filepath Path to the file to scan
+   * @return Future result of the scan; a file that cannot be scanned has
+   *         its error set
+   */
+  std::future<ScanResult> scanFile(const std::string& filepath);
+  
+  /**
+   * Scan an in-memory buffer in the next batch. The features are built
+   * before returning, so the buffer does not need to outlive the call.
+   * @param data Pointer to the buffer content
+   * @param size Size of the buffer in bytes
+   * @return Future result of the scan; a buffer that cannot be scanned has
+   *         its error set
+   */
+  std::future<ScanResult> scanBuffer(const uint8_t* data, size_t size);
+  
+  /**
+   * Get the batch size and queue wait counters
+   * @return Counters since the scheduler was created
+   */
+  BatchSchedulerStats stats() const;
 };
 
 #endif  // MAGIKACPP_H_
\ No newline at end of file
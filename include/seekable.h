@@ -5,24 +5,86 @@
 #include <vector>
 #include <fstream>
 #include <memory>
+#include <cstdint>
+
+/**
+ * ReadRange describes one positional read into a caller-owned buffer.
+ */
+struct ReadRange {
+  size_t offset;
+  size_t size;
+  uint8_t* buffer;
+};
+
+// Default largest gap read_ranges reads and discards between two ranges so
+// that they share one syscall. A few pages: a larger gap saves a syscall at
+// the cost of bandwidth on network filesystems
+const size_t k_default_coalesce_gap = 8 * 1024;
+
+/**
+ * ReadHints tells the kernel how the files being scanned are accessed, so
+ * that reading a few blocks of each file does not thrash the page cache.
+ * Hints are ignored on platforms that do not support them.
+ */
+struct ReadHints {
+  // Disable readahead on the file (POSIX_FADV_RANDOM / MADV_RANDOM)
+  bool random_access = true;
+  // Drop the file's pages from the page cache once read (POSIX_FADV_DONTNEED)
+  bool drop_cache = false;
+  // Do not update the access time (O_NOATIME), skipped when not permitted
+  bool no_atime = false;
+  // Bypass the page cache (O_DIRECT). Reads are widened to the alignment
+  // boundary in a bounce buffer; files on filesystems that reject O_DIRECT
+  // are read through the page cache instead
+  bool direct_io = false;
+};
 
 class Seekable {
  private:
+#ifdef _WIN32
   std::unique_ptr<std::ifstream> file_stream;
+#else
+  int fd;
+  // False for descriptors borrowed from the caller, which are never closed
+  bool owns_fd;
+  // Whether the descriptor was opened with O_DIRECT
+  bool direct_io;
+  
+  bool read_ranges_direct(const ReadRange* const* order, size_t count, size_t max_gap);
+#endif
   size_t file_size;
+  bool drop_cache;
 
  public:
   /**
    * Constructor that creates a Seekable object from a file path
    * @param filepath Path to the file
+   * @param hints Access hints given to the kernel
    */
-  explicit Seekable(const std::string& filepath);
+  explicit Seekable(const std::string& filepath, const ReadHints& hints = ReadHints());
+  
+#ifndef _WIN32
+  /**
+   * Constructor that creates a Seekable object from a descriptor opened by
+   * the caller. Reads are positional, so the descriptor's file offset is
+   * left untouched, and it is not closed. random_access is not applied, as
+   * it would change the readahead of the caller's open file. Descriptors
+   * opened with O_DIRECT are read through aligned bounce buffers.
+   * @param fd Open file descriptor
+   * @param hints Access hints given to the kernel
+   * @throws std::runtime_error if the descriptor is not a regular file
+   */
+  explicit Seekable(int fd, const ReadHints& hints = ReadHints());
+#endif
   
   /**
    * Destructor
    */
   ~Seekable();
   
+  Seekable(const Seekable&) = delete;
+  Seekable& operator=(const Seekable&) = delete;
+  
   /**
    * Get the file size
    * @return File size in bytes
@@ -36,6 +98,81 @@ class Seekable {
    * @return Read data
    */
   std::vector<uint8_t> read_at(size_t offset, size_t size);
+  
+  /**
+   * Read data of specified size from a given offset into a caller-owned
+   * buffer, without allocating
+   * @param offset Offset to start reading from
+   * @param buffer Buffer receiving the data
+   * @param size Number of bytes to read
+   */
+  void read_into(size_t offset, uint8_t* buffer, size_t size);
+  
+  /**
+   * Read several ranges at once into their caller-owned buffers. Ranges
+   * that are close to each other in the file are fetched together with a
+   * single preadv, so all the ranges needed for feature extraction usually
+   * cost one or two syscalls.
+   * @param ranges Ranges to read, each must lie within the file
+   * @param count Number of ranges
+   * @param max_gap Largest gap between two ranges read and discarded so
+   *        that they are fetched together, 0 never reads extra bytes
+   */
+  void read_ranges(const ReadRange* ranges, size_t count, size_t max_gap = k_default_coalesce_gap);
+};
+
+/**
+ * MappedSeekable maps a whole file read-only into memory and hands out
+ * views of it, so that feature extraction never copies the file content.
+ * Touching a page past the end of a file truncated while it is mapped
+ * raises SIGBUS, check size_changed() before reading the mapping.
+ */
+class MappedSeekable {
+ private:
+  const uint8_t* mapped_data;
+  size_t file_size;
+#ifndef _WIN32
+  // Kept open until unmapped to check the size and drop the cached pages
+  int fd;
+  bool drop_cache;
+#endif
+
+ public:
+  /**
+   * Constructor that maps the file at the given path
+   * @param filepath Path to the file
+   * @param hints Access hints given to the kernel
+   */
+  explicit MappedSeekable(const std::string& filepath, const ReadHints& hints = ReadHints());
+  
+  /**
+   * Destructor, unmaps the file
+   */
+  ~MappedSeekable();
+  
+  MappedSeekable(const MappedSeekable&) = delete;
+  MappedSeekable& operator=(const MappedSeekable&) = delete;
+  
+  /**
+   * Get the file size
+   * @return File size in bytes
+   */
+  size_t size() const;
+  
+  /**
+   * Get the mapped file content
+   * @return Pointer to the first byte, nullptr for an empty file
+   */
+  const uint8_t* data() const;
+  
+  /**
+   * Check whether the file size changed since it was mapped, in which case
+   * the mapping may no longer be safe to read and the file should be read
+   * with Seekable instead. A truncation racing with the reads that follow
+   * cannot be detected.
+   * @return True when the file no longer has the mapped size
+   */
+  bool size_changed() const;
 };
 
-#endif  // MAGIKACPP_SEEKABLE_H_
\ No newline at end of file
+#endif  // MAGIKACPP_SEEKABLE_H_
@@ -0,0 +1,528 @@
+#include "batchreader.h"
+#include "seekable.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_CUR_PERSONALITY)
+// openat, statx, read and close operations exist since Linux 5.6
+#define MAGIKACPP_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef MAGIKACPP_HAVE_IO_URING
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef MAGIKACPP_HAVE_IO_URING
+
+/**
+ * Ring is a minimal io_uring submission/completion queue pair driven through
+ * the raw syscalls, so that no liburing is needed to build or run.
+ */
+class BatchReader::Ring {
+ private:
+  int ring_fd;
+  void* sq_ptr;
+  size_t sq_len;
+  void* cq_ptr;
+  size_t cq_len;
+  struct io_uring_sqe* sqes;
+  size_t sqes_len;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  unsigned sq_entries;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+  // Tail of the SQEs handed out by GetSqe, published on Submit
+  unsigned sqe_tail;
+
+  Ring() : ring_fd(-1), sq_ptr(MAP_FAILED), sq_len(0), cq_ptr(MAP_FAILED), cq_len(0),
+           sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)), sqes_len(0), sqe_tail(0) {}
+
+  bool Setup(unsigned entries);
+  bool SupportsOps();
+
+ public:
+  /**
+   * Create a ring, or return nullptr when the kernel does not support
+   * io_uring or the operations used by BatchReader
+   * @param entries Number of submission queue entries
+   * @return The ring or nullptr
+   */
+  static std::unique_ptr<Ring> Create(unsigned entries);
+
+  ~Ring();
+
+  /**
+   * Get a cleared SQE, submitting the pending ones first if the queue is full
+   * @return SQE to fill in
+   */
+  struct io_uring_sqe* GetSqe();
+
+  /**
+   * Submit the pending SQEs and wait for completions
+   * @param wait_nr Number of completions to wait for
+   */
+  void Submit(unsigned wait_nr);
+
+  /**
+   * Pop a completion if one is available
+   * @param cqe Receives the completion
+   * @return False when the completion queue is empty
+   */
+  bool PopCqe(struct io_uring_cqe* cqe);
+};
+
+std::unique_ptr<BatchReader::Ring> BatchReader::Ring::Create(unsigned entries) {
+  std::unique_ptr<Ring> ring(new Ring());
+  if (!ring->Setup(entries) || !ring->SupportsOps()) {
+    return nullptr;
+  }
+  return ring;
+}
+
+bool BatchReader::Ring::Setup(unsigned entries) {
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (ring_fd < 0) {
+    return false;
+  }
+
+  // Map the submission and completion rings and the SQE array
+  sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    sq_len = cq_len = std::max(sq_len, cq_len);
+  }
+  sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED) {
+    return false;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ptr = sq_ptr;
+  } else {
+    cq_ptr = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) {
+      return false;
+    }
+  }
+  sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes_ptr = mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring_fd, IORING_OFF_SQES);
+  if (sqes_ptr == MAP_FAILED) {
+    return false;
+  }
+  sqes = static_cast<struct io_uring_sqe*>(sqes_ptr);
+
+  char* sq = static_cast<char*>(sq_ptr);
+  sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  sq_entries = params.sq_entries;
+  sqe_tail = *sq_tail;
+
+  char* cq = static_cast<char*>(cq_ptr);
+  cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  return true;
+}
+
+bool BatchReader::Ring::SupportsOps() {
+  // Probe for the operations used by BatchReader, io_uring may be present
+  // but restricted (e.g. by seccomp or io_uring_disabled)
+  const size_t probe_ops = 256;
+  std::vector<uint8_t> storage(sizeof(struct io_uring_probe) + probe_ops * sizeof(struct io_uring_probe_op));
+  struct io_uring_probe* probe = reinterpret_cast<struct io_uring_probe*>(storage.data());
+  if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, probe_ops) < 0) {
+    return false;
+  }
+
+  const int ops[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE, IORING_OP_FADVISE };
+  for (int op : ops) {
+    if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+BatchReader::Ring::~Ring() {
+  if (sqes != MAP_FAILED) {
+    munmap(sqes, sqes_len);
+  }
+  if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+    munmap(cq_ptr, cq_len);
+  }
+  if (sq_ptr != MAP_FAILED) {
+    munmap(sq_ptr, sq_len);
+  }
+  if (ring_fd >= 0) {
+    close(ring_fd);
+  }
+}
+
+struct io_uring_sqe* BatchReader::Ring::GetSqe() {
+  if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+    Submit(0);
+  }
+
+  unsigned index = sqe_tail & *sq_mask;
+  struct io_uring_sqe* sqe = &sqes[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array[index] = index;
+  sqe_tail++;
+  return sqe;
+}
+
+void BatchReader::Ring::Submit(unsigned wait_nr) {
+  __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+  unsigned to_submit = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  while (syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr, flags, nullptr, 0) < 0) {
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+    }
+    to_submit = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  }
+}
+
+bool BatchReader::Ring::PopCqe(struct io_uring_cqe* cqe) {
+  unsigned head = *cq_head;
+  if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  *cqe = cqes[head & *cq_mask];
+  __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// Operations tagged in the user data of each SQE, along with the slot and
+// the index of the range being read
+enum RingOp : uint64_t {
+  kRingOpOpen = 0,
+  kRingOpStatx = 1,
+  kRingOpRead = 2,
+  kRingOpClose = 3,
+  kRingOpFadvise = 4,
+};
+
+static uint64_t RingUserData(size_t slot, size_t range, RingOp op) {
+  return (static_cast<uint64_t>(slot) << 16) | (static_cast<uint64_t>(range) << 8) | op;
+}
+
+/**
+ * RingSlot tracks one file in flight.
+ */
+struct RingSlot {
+  size_t index;
+  int fd;
+  int open_flags;
+  unsigned reads_pending;
+  struct statx stx;
+  FeatureReads reads;
+  // Bytes already read of each range, short reads are resubmitted
+  size_t range_done[7];
+  std::string error;
+};
+
+void BatchReader::ReadWithRing(const std::vector<std::string>& filepaths, const BatchCallback& callback) {
+  std::vector<RingSlot> slots(queue_depth);
+  std::vector<size_t> free_slots;
+  free_slots.reserve(queue_depth);
+  for (size_t i = queue_depth; i > 0; i--) {
+    free_slots.push_back(i - 1);
+  }
+
+  size_t next_file = 0;
+  size_t inflight = 0;
+
+  // Give an access hint for the whole file, when linked the next SQE only
+  // starts once it completed, whatever its result
+  auto prep_fadvise = [&](size_t s, int advice, bool link) {
+    struct io_uring_sqe* sqe = ring->GetSqe();
+    sqe->opcode = IORING_OP_FADVISE;
+    sqe->fd = slots[s].fd;
+    sqe->fadvise_advice = static_cast<uint32_t>(advice);
+    if (link) {
+      sqe->flags = IOSQE_IO_HARDLINK;
+    }
+    sqe->user_data = RingUserData(s, 0, kRingOpFadvise);
+    inflight++;
+  };
+  
+  // Submit the openat of a file
+  auto prep_openat = [&](size_t s) {
+    struct io_uring_sqe* sqe = ring->GetSqe();
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(filepaths[slots[s].index].c_str());
+    sqe->open_flags = static_cast<uint32_t>(slots[s].open_flags);
+    sqe->user_data = RingUserData(s, 0, kRingOpOpen);
+    inflight++;
+  };
+  
+  // Get the size of the opened descriptor, not of the path which may have
+  // been replaced since the open
+  auto prep_statx = [&](size_t s) {
+    struct io_uring_sqe* sqe = ring->GetSqe();
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = slots[s].fd;
+    sqe->addr = reinterpret_cast<uint64_t>("");
+    sqe->len = STATX_SIZE;
+    sqe->statx_flags = AT_EMPTY_PATH;
+    sqe->off = reinterpret_cast<uint64_t>(&slots[s].stx);
+    sqe->user_data = RingUserData(s, 0, kRingOpStatx);
+    inflight++;
+  };
+  
+  // Submit the read of what remains of a range
+  auto prep_read = [&](size_t s, size_t r) {
+    RingSlot& slot = slots[s];
+    const ReadRange& range = slot.reads.ranges[r];
+    size_t done = slot.range_done[r];
+    struct io_uring_sqe* sqe = ring->GetSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(range.buffer + done);
+    sqe->len = static_cast<uint32_t>(range.size - done);
+    sqe->off = range.offset + done;
+    sqe->user_data = RingUserData(s, r, kRingOpRead);
+    inflight++;
+  };
+  
+  // Hand the file over to the callback, closing its descriptor asynchronously
+  auto finish = [&](size_t s) {
+    RingSlot& slot = slots[s];
+    if (slot.fd >= 0) {
+      if (hints.drop_cache) {
+        prep_fadvise(s, POSIX_FADV_DONTNEED, true);
+      }
+      struct io_uring_sqe* sqe = ring->GetSqe();
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->fd = slot.fd;
+      sqe->user_data = RingUserData(s, 0, kRingOpClose);
+      inflight++;
+      slot.fd = -1;
+    }
+
+    BatchItem item = { slot.index, slot.error.empty() ? &slot.reads : nullptr, slot.error };
+    callback(item);
+    free_slots.push_back(s);
+  };
+
+  // Once statx completed, submit the reads of the planned ranges. They are
+  // independent of each other, the kernel may run them in any order
+  auto start_reads = [&](size_t s, int statx_res) {
+    RingSlot& slot = slots[s];
+    if (statx_res < 0) {
+      slot.error = "Cannot get file size: " + filepaths[slot.index];
+      finish(s);
+      return;
+    }
+
+    PlanFeatureReads(static_cast<size_t>(slot.stx.stx_size), config, slot.reads);
+    slot.reads_pending = 0;
+    for (size_t r = 0; r < slot.reads.range_count; r++) {
+      slot.range_done[r] = 0;
+      if (slot.reads.ranges[r].size == 0) {
+        continue;
+      }
+      prep_read(s, r);
+      slot.reads_pending++;
+    }
+    if (slot.reads_pending == 0) {
+      finish(s);
+    }
+  };
+  
+  // Process the completions, submitting the operations that follow them
+  auto complete = [&](const struct io_uring_cqe& cqe) {
+    inflight--;
+    size_t s = static_cast<size_t>(cqe.user_data >> 16);
+    size_t r = static_cast<size_t>((cqe.user_data >> 8) & 0xff);
+    RingSlot& slot = slots[s];
+    switch (static_cast<RingOp>(cqe.user_data & 0xff)) {
+      case kRingOpOpen:
+#ifdef O_NOATIME
+        if (cqe.res == -EPERM && (slot.open_flags & O_NOATIME)) {
+          // O_NOATIME is only permitted to the file owner, open normally
+          slot.open_flags &= ~O_NOATIME;
+          prep_openat(s);
+          break;
+        }
+#endif
+        if (cqe.res < 0) {
+          slot.error = "Cannot open file: " + filepaths[slot.index];
+          finish(s);
+          break;
+        }
+        slot.fd = cqe.res;
+        prep_statx(s);
+        // Disabling readahead is only a hint, the reads do not wait for it
+        if (hints.random_access) {
+          prep_fadvise(s, POSIX_FADV_RANDOM, false);
+        }
+        break;
+      case kRingOpStatx:
+        start_reads(s, cqe.res);
+        break;
+      case kRingOpRead:
+        if (slot.error.empty()) {
+          if (cqe.res < 0) {
+            slot.error = std::string("Failed to read file: ") + std::strerror(-cqe.res);
+          } else if (cqe.res == 0) {
+            slot.error = "Unexpected end of file";
+          } else {
+            slot.range_done[r] += static_cast<size_t>(cqe.res);
+            if (slot.range_done[r] < slot.reads.ranges[r].size) {
+              // Short read, read the rest of the range
+              prep_read(s, r);
+              break;
+            }
+          }
+        }
+        if (--slot.reads_pending == 0) {
+          finish(s);
+        }
+        break;
+      case kRingOpClose:
+      case kRingOpFadvise:
+        break;
+    }
+  };
+
+  try {
+    while (next_file < filepaths.size() || inflight > 0) {
+      // Start as many files as there are free slots
+      while (next_file < filepaths.size() && !free_slots.empty()) {
+        size_t s = free_slots.back();
+        free_slots.pop_back();
+        RingSlot& slot = slots[s];
+        slot.index = next_file++;
+        slot.fd = -1;
+        slot.open_flags = O_RDONLY | O_CLOEXEC;
+#ifdef O_NOATIME
+        if (hints.no_atime) {
+          slot.open_flags |= O_NOATIME;
+        }
+#endif
+        slot.reads_pending = 0;
+        slot.error.clear();
+        prep_openat(s);
+      }
+  
+      ring->Submit(1);
+  
+      struct io_uring_cqe cqe;
+      while (ring->PopCqe(&cqe)) {
+        complete(cqe);
+      }
+    }
+  } catch (...) {
+    // The operations in flight still point into the slots, wait for them
+    // before the slots are freed, and close the descriptors left open
+    try {
+      struct io_uring_cqe cqe;
+      while (inflight > 0) {
+        ring->Submit(1);
+        while (ring->PopCqe(&cqe)) {
+          inflight--;
+          if ((cqe.user_data & 0xff) == kRingOpOpen && cqe.res >= 0) {
+            slots[cqe.user_data >> 16].fd = cqe.res;
+          }
+        }
+      }
+      for (const RingSlot& slot : slots) {
+        if (slot.fd >= 0) {
+          close(slot.fd);
+        }
+      }
+    } catch (...) {
+      // The ring cannot be waited on, leak it with the slots so that the
+      // kernel never writes into freed memory, later reads use Seekable
+      new std::vector<RingSlot>(std::move(slots));
+      ring.release();
+    }
+    throw;
+  }
+}
+
+#else
+
+// Without io_uring support in the headers the reader always uses Seekable
+class BatchReader::Ring {
+ public:
+  static std::unique_ptr<Ring> Create(unsigned) { return nullptr; }
+};
+
+void BatchReader::ReadWithRing(const std::vector<std::string>& filepaths, const BatchCallback& callback) {
+  ReadWithSeekable(filepaths, callback);
+}
+
+#endif
+
+BatchReader::BatchReader(const Config& cfg, unsigned depth, const ReadHints& read_hints) :
+    config(cfg),
+    queue_depth(std::max(1u, std::min(depth, 1024u))),
+    hints(read_hints) {
+  // Each slot has at most 10 operations in flight: the fadvise and close of
+  // the previous file in the slot, plus the readahead fadvise and 7 reads
+  unsigned entries = 1;
+  while (entries < queue_depth * 16) {
+    entries <<= 1;
+  }
+  
+  // Direct reads need aligned bounce buffers, which Seekable provides
+  if (!hints.direct_io) {
+    ring = Ring::Create(entries);
+  }
+}
+
+BatchReader::~BatchReader() = default;
+
+bool BatchReader::uses_io_uring() const {
+  return ring != nullptr;
+}
+
+void BatchReader::Read(const std::vector<std::string>& filepaths, const BatchCallback& callback) {
+  if (ring) {
+    ReadWithRing(filepaths, callback);
+  } else {
+    ReadWithSeekable(filepaths, callback);
+  }
+}
+
+void BatchReader::ReadWithSeekable(const std::vector<std::string>& filepaths, const BatchCallback& callback) {
+  FeatureReads reads;
+  for (size_t i = 0; i < filepaths.size(); i++) {
+    BatchItem item = { i, nullptr, std::string() };
+    try {
+      Seekable seekable(filepaths[i], hints);
+      PlanFeatureReads(seekable.size(), config, reads);
+      seekable.read_ranges(reads.ranges, reads.range_count);
+      item.reads = &reads;
+    } catch (const std::exception& e) {
+      item.error = e.what();
+    }
+    callback(item);
+  }
+}
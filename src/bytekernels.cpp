@@ -0,0 +1,384 @@
+#include "bytekernels.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MAGIKACPP_X86_KERNELS 1
+// Each kernel is compiled for its own instruction set, whatever the flags
+// of the rest of the library
+#define MAGIKACPP_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define MAGIKACPP_X86_KERNELS 1
+#define MAGIKACPP_TARGET(isa)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static void WidenScalar(const uint8_t* bytes, size_t count, int32_t* out) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = bytes[i];
+  }
+}
+
+static void FillScalar(int32_t* out, size_t count, int32_t value) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = value;
+  }
+}
+
+static void Widen16Scalar(const uint8_t* bytes, size_t count, uint16_t* out) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = bytes[i];
+  }
+}
+
+static void Fill16Scalar(uint16_t* out, size_t count, uint16_t value) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = value;
+  }
+}
+
+// IsWhitespace reports whether the byte is one of "\t\n\v\f\r "
+static inline bool IsWhitespace(uint8_t byte) {
+  return byte == ' ' || (byte >= '\t' && byte <= '\r');
+}
+
+static size_t SkipWhitespaceScalar(const uint8_t* bytes, size_t count) {
+  size_t i = 0;
+  while (i < count && IsWhitespace(bytes[i])) {
+    i++;
+  }
+  return i;
+}
+
+static size_t TrimWhitespaceScalar(const uint8_t* bytes, size_t count) {
+  while (count > 0 && IsWhitespace(bytes[count - 1])) {
+    count--;
+  }
+  return count;
+}
+
+static const ByteKernels kScalarKernels = {
+  "scalar", WidenScalar, FillScalar, SkipWhitespaceScalar, TrimWhitespaceScalar, Widen16Scalar, Fill16Scalar
+};
+
+#ifdef MAGIKACPP_X86_KERNELS
+// LowestBit returns the index of the lowest set bit of a non-zero mask
+static inline unsigned LowestBit(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return index;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+// HighestBit returns the index of the highest set bit of a non-zero mask
+static inline unsigned HighestBit(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long index;
+  _BitScanReverse(&index, mask);
+  return index;
+#else
+  return 31 - __builtin_clz(mask);
+#endif
+}
+
+// WhitespaceMaskSse41 sets bit i when byte i of v is whitespace: a space,
+// or a byte that lands in 0..4 once '\t' is subtracted
+MAGIKACPP_TARGET("sse4.1")
+static inline uint32_t WhitespaceMaskSse41(__m128i v) {
+  __m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+  __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+  __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+  return static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(space, control)));
+}
+
+MAGIKACPP_TARGET("sse4.1")
+static size_t SkipWhitespaceSse41(const uint8_t* bytes, size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+    uint32_t text = ~WhitespaceMaskSse41(v) & 0xffff;
+    if (text != 0) {
+      return i + LowestBit(text);
+    }
+  }
+  return i + SkipWhitespaceScalar(bytes + i, count - i);
+}
+
+MAGIKACPP_TARGET("sse4.1")
+static size_t TrimWhitespaceSse41(const uint8_t* bytes, size_t count) {
+  while (count >= 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + count - 16));
+    uint32_t text = ~WhitespaceMaskSse41(v) & 0xffff;
+    if (text != 0) {
+      return count - 16 + HighestBit(text) + 1;
+    }
+    count -= 16;
+  }
+  return TrimWhitespaceScalar(bytes, count);
+}
+
+MAGIKACPP_TARGET("sse4.1")
+static void WidenSse41(const uint8_t* bytes, size_t count, int32_t* out) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_cvtepu8_epi32(v));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), _mm_cvtepu8_epi32(_mm_srli_si128(v, 4)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 12), _mm_cvtepu8_epi32(_mm_srli_si128(v, 12)));
+  }
+  WidenScalar(bytes + i, count - i, out + i);
+}
+
+MAGIKACPP_TARGET("sse4.1")
+static void FillSse41(int32_t* out, size_t count, int32_t value) {
+  __m128i v = _mm_set1_epi32(value);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+  }
+  FillScalar(out + i, count - i, value);
+}
+
+MAGIKACPP_TARGET("sse4.1")
+static void Widen16Sse41(const uint8_t* bytes, size_t count, uint16_t* out) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_cvtepu8_epi16(v));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_cvtepu8_epi16(_mm_srli_si128(v, 8)));
+  }
+  Widen16Scalar(bytes + i, count - i, out + i);
+}
+
+MAGIKACPP_TARGET("sse4.1")
+static void Fill16Sse41(uint16_t* out, size_t count, uint16_t value) {
+  __m128i v = _mm_set1_epi16(static_cast<short>(value));
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+  }
+  Fill16Scalar(out + i, count - i, value);
+}
+
+MAGIKACPP_TARGET("avx2")
+static void WidenAvx2(const uint8_t* bytes, size_t count, int32_t* out) {
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i + 16));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi32(lo));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 8), _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16), _mm256_cvtepu8_epi32(hi));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 24), _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+  }
+  WidenSse41(bytes + i, count - i, out + i);
+}
+
+// WhitespaceMaskAvx2 sets bit i when byte i of v is whitespace
+MAGIKACPP_TARGET("avx2")
+static inline uint32_t WhitespaceMaskAvx2(__m256i v) {
+  __m256i space = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+  __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+  __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+  return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(space, control)));
+}
+
+MAGIKACPP_TARGET("avx2")
+static size_t SkipWhitespaceAvx2(const uint8_t* bytes, size_t count) {
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + i));
+    uint32_t text = ~WhitespaceMaskAvx2(v);
+    if (text != 0) {
+      return i + LowestBit(text);
+    }
+  }
+  return i + SkipWhitespaceSse41(bytes + i, count - i);
+}
+
+MAGIKACPP_TARGET("avx2")
+static size_t TrimWhitespaceAvx2(const uint8_t* bytes, size_t count) {
+  while (count >= 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + count - 32));
+    uint32_t text = ~WhitespaceMaskAvx2(v);
+    if (text != 0) {
+      return count - 32 + HighestBit(text) + 1;
+    }
+    count -= 32;
+  }
+  return TrimWhitespaceSse41(bytes, count);
+}
+
+MAGIKACPP_TARGET("avx2")
+static void FillAvx2(int32_t* out, size_t count, int32_t value) {
+  __m256i v = _mm256_set1_epi32(value);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), v);
+  }
+  FillScalar(out + i, count - i, value);
+}
+
+// AlignHead16 is the number of tokens to write before out reaches a 32-byte
+// boundary. Rows are written at any token offset, so most unaligned 32-byte
+// stores would straddle two cache lines
+static inline size_t AlignHead16(const uint16_t* out, size_t count) {
+  size_t head = ((32 - (reinterpret_cast<uintptr_t>(out) & 31)) & 31) / sizeof(uint16_t);
+  return head < count ? head : count;
+}
+
+MAGIKACPP_TARGET("avx2")
+static void Widen16Avx2(const uint8_t* bytes, size_t count, uint16_t* out) {
+  size_t i = AlignHead16(out, count);
+  Widen16Scalar(bytes, i, out);
+  for (; i + 32 <= count; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + i));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(out + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+  }
+  if (i + 16 <= count) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi16(v));
+    i += 16;
+  }
+  Widen16Scalar(bytes + i, count - i, out + i);
+}
+
+MAGIKACPP_TARGET("avx2")
+static void Fill16Avx2(uint16_t* out, size_t count, uint16_t value) {
+  __m256i v = _mm256_set1_epi16(static_cast<short>(value));
+  size_t i = AlignHead16(out, count);
+  Fill16Scalar(out, i, value);
+  for (; i + 16 <= count; i += 16) {
+    _mm256_store_si256(reinterpret_cast<__m256i*>(out + i), v);
+  }
+  Fill16Scalar(out + i, count - i, value);
+}
+
+// The zero-masked conversion is used because the unmasked one trips
+// -Wmaybe-uninitialized inside some versions of the GCC headers
+MAGIKACPP_TARGET("avx512f")
+static void WidenAvx512(const uint8_t* bytes, size_t count, int32_t* out) {
+  size_t i = 0;
+  for (; i + 64 <= count; i += 64) {
+    for (size_t k = 0; k < 64; k += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i + k));
+      _mm512_storeu_si512(out + i + k, _mm512_maskz_cvtepu8_epi32(0xffff, v));
+    }
+  }
+  for (; i + 16 <= count; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+    _mm512_storeu_si512(out + i, _mm512_maskz_cvtepu8_epi32(0xffff, v));
+  }
+  WidenScalar(bytes + i, count - i, out + i);
+}
+
+MAGIKACPP_TARGET("avx512f")
+static void FillAvx512(int32_t* out, size_t count, int32_t value) {
+  __m512i v = _mm512_set1_epi32(value);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    _mm512_storeu_si512(out + i, v);
+  }
+  FillScalar(out + i, count - i, value);
+}
+
+static const ByteKernels kSse41Kernels = {
+  "sse4.1", WidenSse41, FillSse41, SkipWhitespaceSse41, TrimWhitespaceSse41, Widen16Sse41, Fill16Sse41
+};
+static const ByteKernels kAvx2Kernels = {
+  "avx2", WidenAvx2, FillAvx2, SkipWhitespaceAvx2, TrimWhitespaceAvx2, Widen16Avx2, Fill16Avx2
+};
+// Byte compares and 16-bit conversions need AVX-512BW, every AVX-512F CPU
+// has AVX2 for them. bench_widen measures the AVX2 widen16 and fill16 ahead
+// of the SSE4.1 ones, and of either one mixed with the SSE4.1 other
+static const ByteKernels kAvx512Kernels = {
+  "avx512f", WidenAvx512, FillAvx512, SkipWhitespaceAvx2, TrimWhitespaceAvx2, Widen16Avx2, Fill16Avx2
+};
+
+// CpuIsa is the best instruction set supported by the CPU and the OS
+enum class CpuIsa { kScalar, kSse41, kAvx2, kAvx512 };
+
+#if defined(_MSC_VER) && !defined(__clang__)
+static CpuIsa DetectCpuIsa() {
+  int info[4];
+  __cpuid(info, 0);
+  int max_leaf = info[0];
+  if (max_leaf < 1) {
+    return CpuIsa::kScalar;
+  }
+  
+  __cpuid(info, 1);
+  bool sse41 = (info[2] & (1 << 19)) != 0;
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  if (!sse41) {
+    return CpuIsa::kScalar;
+  }
+  if (!osxsave || !avx || max_leaf < 7) {
+    return CpuIsa::kSse41;
+  }
+  
+  // The OS must save the YMM (and ZMM) registers on context switches
+  unsigned long long xcr0 = _xgetbv(0);
+  __cpuidex(info, 7, 0);
+  bool avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+  bool avx512f = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+  if (avx512f) {
+    return CpuIsa::kAvx512;
+  }
+  return avx2 ? CpuIsa::kAvx2 : CpuIsa::kSse41;
+}
+#else
+static CpuIsa DetectCpuIsa() {
+  // __builtin_cpu_supports also checks that the OS saves the wide registers
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return CpuIsa::kAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return CpuIsa::kAvx2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return CpuIsa::kSse41;
+  }
+  return CpuIsa::kScalar;
+}
+#endif
+#endif
+
+const ByteKernels& SelectByteKernels() {
+  static const ByteKernels* selected = [] {
+    const ByteKernels* kernels[4];
+    size_t count = ListByteKernels(kernels, 4);
+    return kernels[count - 1];
+  }();
+  return *selected;
+}
+
+size_t ListByteKernels(const ByteKernels** kernels, size_t max_count) {
+  const ByteKernels* supported[4] = { &kScalarKernels };
+  size_t count = 1;
+#ifdef MAGIKACPP_X86_KERNELS
+  CpuIsa isa = DetectCpuIsa();
+  if (isa >= CpuIsa::kSse41) {
+    supported[count++] = &kSse41Kernels;
+  }
+  if (isa >= CpuIsa::kAvx2) {
+    supported[count++] = &kAvx2Kernels;
+  }
+  if (isa >= CpuIsa::kAvx512) {
+    supported[count++] = &kAvx512Kernels;
+  }
+#endif
+  
+  count = count < max_count ? count : max_count;
+  for (size_t i = 0; i < count; i++) {
+    kernels[i] = supported[i];
+  }
+  return count;
+}
@@ -0,0 +1,215 @@
+#include "featureexport.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+// Length of the magic string, version and header length of a .npy file
+static const size_t kNpyPreambleSize = 10;
+
+// HostByteOrder returns the .npy byte order character of the host, rows
+// are written as they are in memory
+static char HostByteOrder() {
+  const uint16_t one = 1;
+  uint8_t first;
+  std::memcpy(&first, &one, 1);
+  return first == 1 ? '<' : '>';
+}
+
+// MatrixHeader builds the .npy header of a matrix, padded with spaces to
+// k_feature_matrix_header_size bytes whatever the number of rows, so that
+// it can be rewritten in place once all the rows are written
+static std::string MatrixHeader(TokenType token_type, size_t rows, size_t row_size) {
+  std::string dict = "{'descr': '";
+  dict += HostByteOrder();
+  dict += token_type == TokenType::kInt32 ? "i4" : "u2";
+  dict += "', 'fortran_order': False, 'shape': (" + std::to_string(rows) + ", " + std::to_string(row_size) + "), }";
+  
+  size_t dict_size = k_feature_matrix_header_size - kNpyPreambleSize;
+  dict.resize(dict_size - 1, ' ');
+  dict += '\n';
+  
+  std::string header("\x93NUMPY\x01\x00", 8);
+  header += static_cast<char>(dict_size & 0xff);
+  header += static_cast<char>(dict_size >> 8);
+  return header + dict;
+}
+
+// IndexField replaces the characters that would break an index line
+static std::string IndexField(const std::string& field) {
+  std::string result = field;
+  for (char& c : result) {
+    if (c == '\t' || c == '\n' || c == '\r') {
+      c = ' ';
+    }
+  }
+  return result;
+}
+
+FeatureExporter::FeatureExporter(const Config& cfg, const std::string& matrix_path, const std::string& index_path,
+                                 TokenType type, const ReadHints& read_hints) :
+    config(cfg),
+    layout(ComputeFeatureLayout(cfg)),
+    token_type(type),
+    hints(read_hints),
+    row_count(0) {
+  
+  if (token_type == TokenType::kUInt16) {
+    if (cfg.padding_token < 0 || cfg.padding_token > 0xffff) {
+      throw std::runtime_error("Padding token does not fit in uint16 tokens");
+    }
+    row16.resize(layout.row_size);
+  } else {
+    row.resize(layout.row_size);
+  }
+  
+  matrix.open(matrix_path, std::ios::binary | std::ios::trunc);
+  if (!matrix) {
+    throw std::runtime_error("Failed to create feature matrix: " + matrix_path);
+  }
+  index.open(index_path, std::ios::trunc);
+  if (!index) {
+    throw std::runtime_error("Failed to create feature index: " + index_path);
+  }
+  
+  // The shape is written again by Close once the number of rows is known
+  WriteHeader();
+}
+
+FeatureExporter::~FeatureExporter() {
+  try {
+    Close();
+  } catch (...) {
+  }
+}
+
+void FeatureExporter::WriteHeader() {
+  std::string header = MatrixHeader(token_type, row_count, layout.row_size);
+  matrix.write(header.data(), static_cast<std::streamsize>(header.size()));
+  if (!matrix) {
+    throw std::runtime_error("Failed to write feature matrix header");
+  }
+}
+
+void FeatureExporter::WriteIndex(long long row_index, uint64_t fingerprint, const std::string& status,
+                                 const std::string& filepath) {
+  char fingerprint_hex[17];
+  std::snprintf(fingerprint_hex, sizeof(fingerprint_hex), "%016llx", static_cast<unsigned long long>(fingerprint));
+  index << row_index << '\t' << fingerprint_hex << '\t' << IndexField(status) << '\t' << IndexField(filepath) << '\n';
+  if (!index) {
+    throw std::runtime_error("Failed to write feature index");
+  }
+}
+
+bool FeatureExporter::Add(const std::string& filepath) {
+  uint64_t fingerprint = 0;
+  try {
+    Seekable seekable(filepath, hints);
+  
+    // Empty files are labeled without running the model, they have no row
+    if (seekable.size() == 0) {
+      WriteIndex(-1, 0, "empty", filepath);
+      return false;
+    }
+  
+    if (token_type == TokenType::kUInt16) {
+      fingerprint = ExtractFeaturesFromSeekable(seekable, config, layout, row16.data());
+    } else {
+      fingerprint = ExtractFeaturesFromSeekable(seekable, config, layout, row.data());
+    }
+  } catch (const std::exception& e) {
+    WriteIndex(-1, 0, e.what(), filepath);
+    return false;
+  }
+  
+  if (token_type == TokenType::kUInt16) {
+    matrix.write(reinterpret_cast<const char*>(row16.data()),
+                 static_cast<std::streamsize>(row16.size() * sizeof(uint16_t)));
+  } else {
+    matrix.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(int32_t)));
+  }
+  if (!matrix) {
+    throw std::runtime_error("Failed to write feature matrix");
+  }
+  
+  WriteIndex(static_cast<long long>(row_count), fingerprint, "ok", filepath);
+  row_count++;
+  return true;
+}
+
+size_t FeatureExporter::rows() const {
+  return row_count;
+}
+
+void FeatureExporter::Close() {
+  if (!matrix.is_open()) {
+    return;
+  }
+  
+  // Rewrite the header with the final shape
+  matrix.seekp(0);
+  WriteHeader();
+  matrix.close();
+  index.close();
+  if (matrix.fail() || index.fail()) {
+    throw std::runtime_error("Failed to close feature matrix");
+  }
+}
+
+// HeaderValue returns the text following key in a .npy header dictionary
+static std::string HeaderValue(const std::string& dict, const std::string& key) {
+  size_t pos = dict.find("'" + key + "':");
+  if (pos == std::string::npos) {
+    throw std::runtime_error("Feature matrix header has no " + key);
+  }
+  pos += key.size() + 3;
+  while (pos < dict.size() && dict[pos] == ' ') {
+    pos++;
+  }
+  return dict.substr(pos);
+}
+
+void ParseFeatureMatrix(const uint8_t* content, size_t content_size, FeatureMatrix& matrix) {
+  if (content_size < kNpyPreambleSize || std::memcmp(content, "\x93NUMPY\x01\x00", 8) != 0) {
+    throw std::runtime_error("Not a version 1.0 .npy feature matrix");
+  }
+  size_t dict_size = content[8] | (static_cast<size_t>(content[9]) << 8);
+  size_t data_offset = kNpyPreambleSize + dict_size;
+  if (data_offset > content_size) {
+    throw std::runtime_error("Feature matrix header is cut short");
+  }
+  std::string dict(reinterpret_cast<const char*>(content) + kNpyPreambleSize, dict_size);
+  
+  // Matrices written on a host of either byte order are accepted
+  std::string descr = HeaderValue(dict, "descr");
+  size_t token_size;
+  if (descr.size() < 5 || descr[0] != '\'' || (descr[1] != '<' && descr[1] != '>') || descr[4] != '\'') {
+    throw std::runtime_error("Feature matrix tokens must be i4 or u2");
+  }
+  if (descr.compare(2, 2, "i4") == 0) {
+    matrix.token_type = TokenType::kInt32;
+    token_size = sizeof(int32_t);
+  } else if (descr.compare(2, 2, "u2") == 0) {
+    matrix.token_type = TokenType::kUInt16;
+    token_size = sizeof(uint16_t);
+  } else {
+    throw std::runtime_error("Feature matrix tokens must be i4 or u2");
+  }
+  matrix.byte_swapped = descr[1] != HostByteOrder();
+  if (HeaderValue(dict, "fortran_order").compare(0, 5, "False") != 0) {
+    throw std::runtime_error("Feature matrix must be in C order");
+  }
+  
+  unsigned long long rows = 0;
+  unsigned long long row_size = 0;
+  if (std::sscanf(HeaderValue(dict, "shape").c_str(), "(%llu, %llu)", &rows, &row_size) != 2) {
+    throw std::runtime_error("Feature matrix must have two dimensions");
+  }
+  if (data_offset % token_size != 0 || row_size == 0 ||
+      rows > (content_size - data_offset) / token_size / row_size) {
+    throw std::runtime_error("Feature matrix is cut short");
+  }
+  
+  matrix.data = content + data_offset;
+  matrix.rows = static_cast<size_t>(rows);
+  matrix.row_size = static_cast<size_t>(row_size);
+}
@@ -1,9 +1,17 @@
 #include "filefeatures.h"
 #include "seekable.h"
+#include "featureengine.h"
 #include <algorithm>
 #include <cstring>
+#include <stdexcept>
 
 std::vector<int32_t> Features::Flatten() const {
+  std::vector<int32_t> result;
+  FlattenInto(result);
+  return result;
+}
+
+void Features::FlattenInto(std::vector<int32_t>& result) const {
   // Basic size is Beg + End features
   size_t reserved_size = beg.size() + end.size();
   
@@ -18,7 +26,7 @@ std::vector<int32_t> Features::Flatten() const {
                     offset_9000.size() + offset_9800.size();
   }
   
-  std::vector<int32_t> result;
+  result.clear();
   result.reserve(reserved_size);
   
   result.insert(result.end(), beg.begin(), beg.end());
@@ -37,268 +45,222 @@ std::vector<int32_t> Features::Flatten() const {
     result.insert(result.end(), offset_9000.begin(), offset_9000.end());
     result.insert(result.end(), offset_9800.begin(), offset_9800.end());
   }
-  
-  return result;
 }
 
-static std::vector<int32_t> PadInt32(const std::vector<uint8_t>& bytes, size_t prefix, size_t size, int padding_token) {
-  std::vector<int32_t> result;
-  result.reserve(size);
-  
-  // Add prefix padding
-  for (size_t i = 0; i < prefix; i++) {
-    result.push_back(padding_token);
-  }
-  
-  // Add actual bytes (up to size - prefix)
-  size_t bytes_to_add = std::min(bytes.size(), size - prefix);
-  for (size_t i = 0; i < bytes_to_add; i++) {
-    result.push_back(static_cast<int32_t>(bytes[i]));
-  }
-  
-  // Add suffix padding
-  size_t suffix_padding = size - prefix - bytes_to_add;
-  for (size_t i = 0; i < suffix_padding; i++) {
-    result.push_back(padding_token);
+static const size_t kOffsets[4] = { k_offset_8000, k_offset_8800, k_offset_9000, k_offset_9800 };
+
+FeatureLayout ComputeFeatureLayout(const Config& cfg) {
+  FeatureLayout layout;
+  layout.beg_offset = 0;
+  layout.mid_offset = layout.beg_offset + cfg.beg_size;
+  layout.end_offset = layout.mid_offset + std::max(cfg.mid_size, 0);
+  layout.row_size = layout.end_offset + cfg.end_size;
+  for (int i = 0; i < 4; i++) {
+    layout.offset_offsets[i] = layout.row_size;
+    if (cfg.use_inputs_at_offsets) {
+      layout.row_size += k_offset_size;
+    }
   }
-  
-  return result;
+  return layout;
 }
 
-static std::vector<uint8_t> SafeSlice(const std::vector<uint8_t>& vec, size_t start, size_t length) {
-  if (start >= vec.size()) {
-    return std::vector<uint8_t>(length, 0);
-  }
-  
-  size_t actual_length = std::min(length, vec.size() - start);
-  std::vector<uint8_t> result(vec.begin() + start, vec.begin() + start + actual_length);
-  
-  // Pad with zeros if needed
-  result.resize(length, 0);
-  
-  return result;
+Features ExtractFeatures(const std::vector<uint8_t>& content, const Config& cfg) {
+  return ExtractFeatures(content.data(), content.size(), cfg);
 }
 
-static std::vector<int32_t> ExtractOffsetFeatures(const std::vector<uint8_t>& content, size_t offset, const Config& cfg) {
-  if (content.size() <= offset) {
-    // File too small, return padding data
-    return std::vector<int32_t>(8, cfg.padding_token);
-  }
-  
-  // Read 8 bytes from the specified offset
-  std::vector<uint8_t> bytes = SafeSlice(content, offset, 8);
-  
-  // Convert to int32_t and pad to fixed size (8 elements)
-  std::vector<int32_t> result;
-  result.reserve(8);
-  
-  for (const auto& byte : bytes) {
-    result.push_back(static_cast<int32_t>(byte));
-  }
-  
-  return result;
+Features ExtractFeatures(const uint8_t* content, size_t content_size, const Config& cfg) {
+  Features features;
+  ExtractFeatures(content, content_size, cfg, features);
+  return features;
 }
 
-// New: Extract Offset features from Seekable object
-static std::vector<int32_t> ExtractOffsetFeaturesFromSeekable(Seekable& seekable, size_t offset, const Config& cfg) {
-  if (seekable.size() <= offset) {
-    // File too small, return padding data
-    return std::vector<int32_t>(8, cfg.padding_token);
-  }
-  
-  // Read 8 bytes from the specified offset
-  auto bytes = seekable.read_at(offset, 8);
-  
-  // Convert to int32_t and pad to fixed size (8 elements)
-  std::vector<int32_t> result;
-  result.reserve(8);
-  
-  for (const auto& byte : bytes) {
-    result.push_back(static_cast<int32_t>(byte));
-  }
-  
-  // If fewer than 8 bytes were read, pad with padding_token
-  while (result.size() < 8) {
-    result.push_back(cfg.padding_token);
-  }
-  
-  return result;
+void ExtractFeatures(const uint8_t* content, size_t content_size, const Config& cfg, Features& features) {
+  // Blocks are views into content
+  MemorySource source = { content, content_size };
+  FeaturesSink sink(features);
+  ExtractWithEngine(source, RuntimeShape{ cfg }, sink);
 }
 
-Features ExtractFeatures(const std::vector<uint8_t>& content, const Config& cfg) {
-  size_t content_size = content.size();
-  
-  // Read beginning, middle and end blocks
-  size_t beg_size = std::min(content_size, static_cast<size_t>(cfg.block_size));
-  std::vector<uint8_t> beg_bytes(content.begin(), content.begin() + beg_size);
-  
-  std::vector<uint8_t> mid_bytes;
-  if (content_size <= static_cast<size_t>(cfg.mid_size)) {
-    // If content is smaller than or equal to MID_SIZE, use all content
-    mid_bytes = content;
-  } else {
-    // Take middle part
-    size_t mid_start = (content_size - cfg.mid_size) / 2;
-    size_t mid_end = std::min(mid_start + cfg.mid_size, content_size);
-    mid_bytes = std::vector<uint8_t>(content.begin() + mid_start, content.begin() + mid_end);
-  }
-  
-  size_t block_size = std::min(content_size, static_cast<size_t>(cfg.block_size));
-  size_t end_start = content_size - block_size;
-  std::vector<uint8_t> end_bytes(content.begin() + end_start, content.end());
-  
-  // Build features
-  std::vector<uint8_t> first_block = beg_bytes;
-  
-  // Trim beg and end, and truncate to BEG_SIZE and END_SIZE
-  const std::string spaces = "\t\n\v\f\r ";
-  
-  // Remove leading whitespace characters
-  size_t beg_start_pos = 0;
-  while (beg_start_pos < beg_bytes.size() && 
-         spaces.find(beg_bytes[beg_start_pos]) != std::string::npos) {
-    beg_start_pos++;
-  }
-  
-  // Extract valid part
-  if (beg_start_pos < beg_bytes.size()) {
-    beg_bytes = std::vector<uint8_t>(beg_bytes.begin() + beg_start_pos, beg_bytes.end());
-  } else {
-    beg_bytes.clear();
-  }
-  
-  // Limit beg size
-  if (beg_bytes.size() > static_cast<size_t>(cfg.beg_size)) {
-    beg_bytes.resize(cfg.beg_size);
-  }
-  
-  // Remove trailing whitespace characters
-  while (!end_bytes.empty()) {
-    char last_char = static_cast<char>(end_bytes.back());
-    if (spaces.find(last_char) == std::string::npos) {
-      break;
-    }
-    end_bytes.pop_back();
-  }
-  
-  // Limit end size, take from the end
-  if (end_bytes.size() > static_cast<size_t>(cfg.end_size)) {
-    std::vector<uint8_t> temp(end_bytes.end() - cfg.end_size, end_bytes.end());
-    end_bytes = temp;
-  }
-  
-  // Create Features struct
+uint64_t ExtractFeatures(const uint8_t* content, size_t content_size, const Config& cfg, const FeatureLayout& layout,
+                         int32_t* row) {
+  MemorySource source = { content, content_size };
+  RowSink sink = { layout, row };
+  ExtractWithEngine(source, RuntimeShape{ cfg }, sink);
+  return sink.hasher.Digest();
+}
+
+uint64_t ExtractFeatures(const uint8_t* content, size_t content_size, const Config& cfg, const FeatureLayout& layout,
+                         uint16_t* row) {
+  MemorySource source = { content, content_size };
+  Row16Sink sink = { layout, row };
+  ExtractWithEngine(source, RuntimeShape{ cfg }, sink);
+  return sink.hasher.Digest();
+}
+
+// ThreadReads returns the FeatureReads reused by the calling thread.
+static FeatureReads& ThreadReads() {
+  static thread_local FeatureReads reads;
+  return reads;
+}
+
+Features ExtractFeaturesFromSeekable(Seekable& seekable, const Config& cfg) {
   Features features;
-  features.first_block = first_block;
-  
-  // Build beg features
-  features.beg = PadInt32(beg_bytes, 0, cfg.beg_size, cfg.padding_token);
-  
-  // Build mid features
-  if (cfg.mid_size > 0) {
-    features.mid = PadInt32(mid_bytes, (cfg.mid_size - mid_bytes.size()) / 2, cfg.mid_size, cfg.padding_token);
-  }
-  // When MidSize is 0, do not create Mid feature vector, keep features.Mid empty
-  
-  // Build end features
-  features.end = PadInt32(end_bytes, cfg.end_size - end_bytes.size(), cfg.end_size, cfg.padding_token);
-  
-  // Extract Offset features only if use_inputs_at_offsets is true
-  if (cfg.use_inputs_at_offsets) {
-    features.offset_8000 = ExtractOffsetFeatures(content, 0x8000, cfg);
-    features.offset_8800 = ExtractOffsetFeatures(content, 0x8800, cfg);
-    features.offset_9000 = ExtractOffsetFeatures(content, 0x9000, cfg);
-    features.offset_9800 = ExtractOffsetFeatures(content, 0x9800, cfg);
-  }
-  
+  ExtractFeaturesFromSeekable(seekable, cfg, features);
   return features;
 }
 
-Features ExtractFeaturesFromSeekable(Seekable& seekable, const Config& cfg) {
-  size_t content_size = seekable.size();
-  
-  // Read beginning, middle and end blocks (on-demand)
-  size_t beg_size = std::min(content_size, static_cast<size_t>(cfg.block_size));
-  auto beg_bytes = seekable.read_at(0, beg_size);
-  
-  std::vector<uint8_t> mid_bytes;
-  if (content_size <= static_cast<size_t>(cfg.mid_size)) {
-    // If content is smaller than or equal to MID_SIZE, use all content
-    mid_bytes = seekable.read_at(0, content_size);
-  } else {
-    // Take middle part
-    size_t mid_start = (content_size - cfg.mid_size) / 2;
-    size_t mid_end = std::min(mid_start + cfg.mid_size, content_size);
-    mid_bytes = seekable.read_at(mid_start, mid_end - mid_start);
-  }
-  
-  size_t block_size = std::min(content_size, static_cast<size_t>(cfg.block_size));
-  size_t end_start = content_size - block_size;
-  auto end_bytes = seekable.read_at(end_start, block_size);
-  
-  // Build features
-  std::vector<uint8_t> first_block = beg_bytes;
-  
-  // Remove leading and trailing whitespace characters
-  const std::string spaces = "\t\n\v\f\r ";
-  
-  // Remove leading whitespace characters
-  size_t beg_start_pos = 0;
-  while (beg_start_pos < beg_bytes.size() && 
-         spaces.find(beg_bytes[beg_start_pos]) != std::string::npos) {
-    beg_start_pos++;
+void ExtractFeaturesFromSeekable(Seekable& seekable, const Config& cfg, Features& features) {
+  // Compute every range the configuration needs up front, so that they can
+  // all be fetched with as few syscalls as possible. The read buffer is
+  // reused across files by each thread.
+  SeekableSource source = { seekable, ThreadReads() };
+  FeaturesSink sink(features);
+  ExtractWithEngine(source, RuntimeShape{ cfg }, sink);
+}
+
+uint64_t ExtractFeaturesFromSeekable(Seekable& seekable, const Config& cfg, const FeatureLayout& layout,
+                                     int32_t* row) {
+  // Rows do not keep the untrimmed beginning block, only the kept bytes are read
+  AdaptiveSeekableSource source = { seekable, ThreadReads(), static_cast<size_t>(cfg.beg_size),
+                                    static_cast<size_t>(cfg.end_size) };
+  RowSink sink = { layout, row };
+  ExtractWithEngine(source, RuntimeShape{ cfg }, sink);
+  return sink.hasher.Digest();
+}
+
+uint64_t ExtractFeaturesFromSeekable(Seekable& seekable, const Config& cfg, const FeatureLayout& layout,
+                                     uint16_t* row) {
+  AdaptiveSeekableSource source = { seekable, ThreadReads(), static_cast<size_t>(cfg.beg_size),
+                                    static_cast<size_t>(cfg.end_size) };
+  Row16Sink sink = { layout, row };
+  ExtractWithEngine(source, RuntimeShape{ cfg }, sink);
+  return sink.hasher.Digest();
+}
+
+void PlanFeatureReads(size_t content_size, const Config& cfg, FeatureReads& reads, size_t base_offset) {
+  FeatureWindows windows;
+  PlanFeatureWindows(content_size, RuntimeShape{ cfg }, windows);
+  PlanWindowReads(windows, reads, base_offset);
+}
+
+Features ExtractFeaturesFromReads(const FeatureReads& reads, const Config& cfg) {
+  Features features;
+  ExtractFeaturesFromReads(reads, cfg, features);
+  return features;
+}
+
+void ExtractFeaturesFromReads(const FeatureReads& reads, const Config& cfg, Features& features) {
+  ReadsSource source = { reads };
+  FeaturesSink sink(features);
+  ExtractWithEngine(source, RuntimeShape{ cfg }, sink);
+}
+
+uint64_t ExtractFeaturesFromReads(const FeatureReads& reads, const Config& cfg, const FeatureLayout& layout,
+                                  int32_t* row) {
+  ReadsSource source = { reads };
+  RowSink sink = { layout, row };
+  ExtractWithEngine(source, RuntimeShape{ cfg }, sink);
+  return sink.hasher.Digest();
+}
+
+uint64_t ExtractFeaturesFromReads(const FeatureReads& reads, const Config& cfg, const FeatureLayout& layout,
+                                  uint16_t* row) {
+  ReadsSource source = { reads };
+  Row16Sink sink = { layout, row };
+  ExtractWithEngine(source, RuntimeShape{ cfg }, sink);
+  return sink.hasher.Digest();
+}
+
+FeatureStream::FeatureStream(const Config& cfg) :
+    config(cfg),
+    block_size(static_cast<size_t>(std::max(cfg.block_size, 0))),
+    total_size(0),
+    tail(block_size),
+    tail_pos(0) {
+  if (cfg.mid_size > 0) {
+    throw std::runtime_error("Mid features need the stream size and are not supported on streams");
   }
-  
-  // Extract valid part
-  if (beg_start_pos < beg_bytes.size()) {
-    beg_bytes = std::vector<uint8_t>(beg_bytes.begin() + beg_start_pos, beg_bytes.end());
-  } else {
-    beg_bytes.clear();
+  head.reserve(block_size);
+  end_bytes.reserve(block_size);
+}
+
+void FeatureStream::Push(const uint8_t* data, size_t size) {
+  if (size == 0 || block_size == 0) {
+    total_size += size;
+    return;
   }
   
-  // Limit beg size
-  if (beg_bytes.size() > static_cast<size_t>(cfg.beg_size)) {
-    beg_bytes.resize(cfg.beg_size);
+  // Beginning block
+  if (head.size() < block_size) {
+    size_t count = std::min(size, block_size - head.size());
+    head.insert(head.end(), data, data + count);
   }
   
-  // Remove trailing whitespace characters
-  while (!end_bytes.empty()) {
-    char last_char = static_cast<char>(end_bytes.back());
-    if (spaces.find(last_char) == std::string::npos) {
-      break;
+  // Bytes of the offset windows that fall in this chunk
+  if (config.use_inputs_at_offsets) {
+    for (int i = 0; i < 4; i++) {
+      size_t lo = std::max(kOffsets[i], total_size);
+      size_t hi = std::min(kOffsets[i] + k_offset_size, total_size + size);
+      if (lo < hi) {
+        std::memcpy(offset_buffer[i] + (lo - kOffsets[i]), data + (lo - total_size), hi - lo);
+      }
     }
-    end_bytes.pop_back();
   }
   
-  // Limit end size, take from the end
-  if (end_bytes.size() > static_cast<size_t>(cfg.end_size)) {
-    std::vector<uint8_t> temp(end_bytes.end() - cfg.end_size, end_bytes.end());
-    end_bytes = temp;
-  }
-  
-  // Create Features struct
-  Features features;
-  features.first_block = first_block;
-  
-  // Build beg features
-  features.beg = PadInt32(beg_bytes, 0, cfg.beg_size, cfg.padding_token);
-  
-  // Build mid features
-  if (cfg.mid_size > 0) {
-    features.mid = PadInt32(mid_bytes, (cfg.mid_size - mid_bytes.size()) / 2, cfg.mid_size, cfg.padding_token);
+  // Ring buffer of the end block, only the last block_size bytes matter
+  if (size >= block_size) {
+    std::memcpy(tail.data(), data + size - block_size, block_size);
+    tail_pos = 0;
+  } else {
+    size_t first = std::min(size, block_size - tail_pos);
+    std::memcpy(tail.data() + tail_pos, data, first);
+    std::memcpy(tail.data(), data + first, size - first);
+    tail_pos = (tail_pos + size) % block_size;
   }
-  // When MidSize is 0, do not create Mid feature vector, keep features.Mid empty
-  
-  // Build end features
-  features.end = PadInt32(end_bytes, cfg.end_size - end_bytes.size(), cfg.end_size, cfg.padding_token);
   
-  // Extract Offset features based on use_inputs_at_offsets
-  if (cfg.use_inputs_at_offsets) {
-    features.offset_8000 = ExtractOffsetFeaturesFromSeekable(seekable, 0x8000, cfg);
-    features.offset_8800 = ExtractOffsetFeaturesFromSeekable(seekable, 0x8800, cfg);
-    features.offset_9000 = ExtractOffsetFeaturesFromSeekable(seekable, 0x9000, cfg);
-    features.offset_9800 = ExtractOffsetFeaturesFromSeekable(seekable, 0x9800, cfg);
+  total_size += size;
+}
+
+size_t FeatureStream::size() const {
+  return total_size;
+}
+
+void FeatureStream::LayoutTail() {
+  // Lay the ring buffer out in stream order
+  size_t tail_count = std::min(total_size, block_size);
+  if (total_size < block_size) {
+    end_bytes.assign(tail.begin(), tail.begin() + tail_count);
+  } else {
+    end_bytes.assign(tail.begin() + tail_pos, tail.end());
+    end_bytes.insert(end_bytes.end(), tail.begin(), tail.begin() + tail_pos);
   }
-  
-  return features;
-}
\ No newline at end of file
+}
+
+void FeatureStream::Finish(Features& features) {
+  LayoutTail();
+  BufferedSource source = { total_size, head.data(), head.size(), end_bytes.data(), end_bytes.size(), offset_buffer };
+  FeaturesSink sink(features);
+  ExtractWithEngine(source, RuntimeShape{ config }, sink);
+}
+
+uint64_t FeatureStream::Finish(const FeatureLayout& layout, int32_t* row) {
+  LayoutTail();
+  BufferedSource source = { total_size, head.data(), head.size(), end_bytes.data(), end_bytes.size(), offset_buffer };
+  RowSink sink = { layout, row };
+  ExtractWithEngine(source, RuntimeShape{ config }, sink);
+  return sink.hasher.Digest();
+}
+
+uint64_t FeatureStream::Finish(const FeatureLayout& layout, uint16_t* row) {
+  LayoutTail();
+  BufferedSource source = { total_size, head.data(), head.size(), end_bytes.data(), end_bytes.size(), offset_buffer };
+  Row16Sink sink = { layout, row };
+  ExtractWithEngine(source, RuntimeShape{ config }, sink);
+  return sink.hasher.Digest();
+}
+
+void FeatureStream::Reset() {
+  total_size = 0;
+  head.clear();
+  tail_pos = 0;
+}
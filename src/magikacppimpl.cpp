@@ -2,7 +2,10 @@
 #include "filefeatures.h"
 #include "config.h"
 #include "seekable.h"
+#include "batchreader.h"
+#include "featureexport.h"
 #include <onnxruntime_cxx_api.h>
+#include <onnxruntime_session_options_config_keys.h>
 #include <fstream>
 #include <iostream>
 #include <vector>
@@ -10,6 +13,12 @@
 #include <algorithm>
 #include <cstring>
 #include <memory>
+#include <numeric>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -31,43 +40,396 @@ namespace impl {
 #endif
 }
 
+/**
+ * InferenceContext keeps the input and output tensors of up to capacity
+ * rows bound to the session through Ort::IoBinding, so that runs reuse
+ * them instead of allocating tensors and copying the scores out. The
+ * binding for a number of rows is created the first time a batch of that
+ * size is run, usually only full batches and the last one of a scan.
+ */
+class InferenceContext {
+ private:
+  Ort::Session& session;
+  Ort::MemoryInfo memory_info;
+  TokenType token_type;
+  size_t row_size;
+  size_t label_count;
+  // int32 storage keeps rows of either token type aligned
+  std::vector<int32_t> input;
+  std::vector<float> output;
+  // Bindings and the tensors they refer to, indexed by number of rows - 1
+  std::vector<Ort::IoBinding> bindings;
+  std::vector<Ort::Value> input_tensors;
+  std::vector<Ort::Value> output_tensors;
+  
+ public:
+  InferenceContext(Ort::Session& ort_session, TokenType type, size_t tokens_per_row, size_t labels,
+                   size_t capacity);
+  
+  size_t GetCapacity() const { return bindings.size(); }
+  
+  // Input returns the first row of the input, rows are written straight
+  // into it
+  void* Input() { return input.data(); }
+  
+  // Run runs the model on the first count rows of the input and returns
+  // their scores, label_count per row
+  const float* Run(size_t count);
+};
+
+InferenceContext::InferenceContext(Ort::Session& ort_session, TokenType type, size_t tokens_per_row, size_t labels,
+                                   size_t capacity) :
+    session(ort_session),
+    memory_info(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU)),
+    token_type(type),
+    row_size(tokens_per_row),
+    label_count(labels) {
+  
+  size_t token_size = token_type == TokenType::kUInt16 ? sizeof(uint16_t) : sizeof(int32_t);
+  input.resize((capacity * row_size * token_size + sizeof(int32_t) - 1) / sizeof(int32_t));
+  output.resize(capacity * label_count);
+  for (size_t i = 0; i < capacity; i++) {
+    bindings.emplace_back(nullptr);
+    input_tensors.emplace_back(nullptr);
+    output_tensors.emplace_back(nullptr);
+  }
+}
+
+const float* InferenceContext::Run(size_t count) {
+  Ort::IoBinding& binding = bindings[count - 1];
+  if (!binding) {
+    // Tensors are views of the buffers, their first count rows
+    const int64_t input_shape[] = { static_cast<int64_t>(count), static_cast<int64_t>(row_size) };
+    const int64_t output_shape[] = { static_cast<int64_t>(count), static_cast<int64_t>(label_count) };
+    bool narrow = token_type == TokenType::kUInt16;
+    input_tensors[count - 1] = Ort::Value::CreateTensor(
+        memory_info, 
+        input.data(), 
+        count * row_size * (narrow ? sizeof(uint16_t) : sizeof(int32_t)), 
+        input_shape, 
+        2,
+        narrow ? ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT16 : ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32
+    );
+    output_tensors[count - 1] = Ort::Value::CreateTensor<float>(
+        memory_info, 
+        output.data(), 
+        count * label_count, 
+        output_shape, 
+        2
+    );
+    
+    Ort::IoBinding created(session);
+    created.BindInput("bytes", input_tensors[count - 1]);
+    created.BindOutput("target_label", output_tensors[count - 1]);
+    binding = std::move(created);
+  }
+  
+  // Run inference, the scores are written into the output buffer
+  session.Run(Ort::RunOptions{nullptr}, binding);
+  return output.data();
+}
+
+// PrepackedWeightsDeleter releases the container the sessions of a pool
+// share their prepacked weights through
+struct PrepackedWeightsDeleter {
+  void operator()(OrtPrepackedWeightsContainer* container) const {
+    Ort::GetApi().ReleasePrepackedWeightsContainer(container);
+  }
+};
+
 class MagikaImpl {
  private:
   Ort::Env env;
-  Ort::Session session;
+  // Declared before the sessions, which must be released first
+  std::unique_ptr<OrtPrepackedWeightsContainer, PrepackedWeightsDeleter> prepacked_weights;
+  std::vector<Ort::Session> sessions;
+  // Session the next inference context is bound to, contexts are spread
+  // over the pool in turn
+  size_t next_session;
   std::vector<std::string> target_labels;
   Config config;
+  FeatureLayout layout;
+  ScannerOptions options;
+  // Type of the model input, uint16 for models with a leading Cast node
+  TokenType token_type;
+  // Size of a row in bytes
+  size_t row_bytes;
+  // Number of scores the model returns per row
+  size_t label_count;
+  // Inference contexts of batch_size rows not leased by a scan
+  std::mutex context_mutex;
+  std::vector<std::unique_ptr<InferenceContext>> free_contexts;
   
  public:
-  MagikaImpl(const std::string& model_path, const Config& cfg);
+  MagikaImpl(const std::string& model_path, const Config& cfg, const ScannerOptions& scanner_options);
   
   void InitTargetLabels();
   
-  std::pair<std::string, float> ScanFile(const std::string& filepath);
+  const Config& GetConfig() const { return config; }
+  
+  size_t GetRowBytes() const { return row_bytes; }
+  
+  size_t GetBatchSize() const { return options.batch_size; }
+  
+  ScanResult ScanFile(const std::string& filepath);
+  
+  std::vector<ScanResult> ScanFiles(const std::vector<std::string>& filepaths);
+  
+  ScanResult ScanBuffer(const uint8_t* data, size_t size);
+  
+  std::vector<ScanResult> ScanBuffers(const std::vector<BufferView>& buffers);
+  
+  std::vector<ScanResult> ScanRanges(Seekable& seekable, const std::vector<ByteRange>& ranges);
+  
+  ScanResult ScanFd(int fd);
+  
+  std::vector<ScanResult> ScanFds(const std::vector<int>& fds);
+  
+  ReadHints GetReadHints() const;
+  
+  ScanResult ScanStream(FeatureStream& stream);
+  
+  std::vector<ScanResult> ScanFeatureMatrix(const FeatureMatrix& matrix);
+  
+  bool ExtractFile(const std::string& filepath, void* row, uint64_t& fingerprint);
+  
+  bool ExtractFd(int fd, void* row, uint64_t& fingerprint);
+  
+  uint64_t ExtractContent(const uint8_t* data, size_t size, void* row);
+  
+  uint64_t ExtractSeekable(Seekable& seekable, void* row);
+  
+  uint64_t ExtractReads(const FeatureReads& reads, void* row);
+  
+  void* ThreadRow();
+  
+  std::unique_ptr<InferenceContext> NewContext(size_t capacity);
+  
+  std::unique_ptr<InferenceContext> AcquireContext();
+  
+  void ReleaseContext(std::unique_ptr<InferenceContext> context);
+  
+  ScanResult ScanRow(InferenceContext& context, uint64_t fingerprint);
+  
+  void InferRows(InferenceContext& context, size_t count, ScanResult* const* results);
+};
+
+/**
+ * ContextLease holds an inference context of the pool for a scan and
+ * returns it when the scan ends.
+ */
+class ContextLease {
+ private:
+  MagikaImpl& impl;
+  std::unique_ptr<InferenceContext> context;
+  
+ public:
+  explicit ContextLease(MagikaImpl& magika) : impl(magika), context(magika.AcquireContext()) {}
+  
+  ~ContextLease() { impl.ReleaseContext(std::move(context)); }
+  
+  ContextLease(const ContextLease&) = delete;
+  ContextLease& operator=(const ContextLease&) = delete;
+  
+  InferenceContext& operator*() { return *context; }
+  
+  InferenceContext* operator->() { return context.get(); }
+};
+
+/**
+ * RowBatch collects the feature rows of up to batch_size inputs in the
+ * contiguous {B, N} input of a leased inference context and runs the model
+ * once for all of them. A row is only queued by Push, so an input whose
+ * extraction throws after Next leaves no row behind.
+ */
+class RowBatch {
+ private:
+  MagikaImpl& impl;
+  ContextLease context;
+  std::vector<ScanResult*> results;
+  
+ public:
+  explicit RowBatch(MagikaImpl& magika) : impl(magika), context(magika) {
+    results.reserve(impl.GetBatchSize());
+  }
+  
+  // Next returns where to write the row of the next input
+  void* Next() {
+    return static_cast<uint8_t*>(context->Input()) + results.size() * impl.GetRowBytes();
+  }
   
-  std::vector<float> RunInference(const std::vector<int32_t>& features);
+  // Push queues the row written at Next, running the batch once it is full
+  void Push(ScanResult* result, uint64_t fingerprint) {
+    result->fingerprint = fingerprint;
+    results.push_back(result);
+    if (results.size() == impl.GetBatchSize()) {
+      Flush();
+    }
+  }
+  
+  // Flush runs the queued rows, a failed run fails each of their results
+  void Flush() {
+    if (results.empty()) {
+      return;
+    }
+    try {
+      impl.InferRows(*context, results.size(), results.data());
+    } catch (const std::exception& e) {
+      for (ScanResult* result : results) {
+        result->error = e.what();
+      }
+    }
+    results.clear();
+  }
 };
 
-MagikaImpl::MagikaImpl(const std::string& model_path, const Config& cfg) : 
-    env(ORT_LOGGING_LEVEL_WARNING, "MagikaCPP"),
-    session(nullptr),
-    config(cfg) {
+// CreateEnv creates the ONNX Runtime environment, with the thread pools
+// shared by the sessions when asked for
+static Ort::Env CreateEnv(const ScannerOptions& options) {
+  if (!options.global_thread_pools) {
+    return Ort::Env(ORT_LOGGING_LEVEL_WARNING, "MagikaCPP");
+  }
+  
+  Ort::ThreadingOptions threading_options;
+  threading_options.SetGlobalIntraOpNumThreads(options.intra_op_threads);
+  threading_options.SetGlobalInterOpNumThreads(options.inter_op_threads);
+  threading_options.SetGlobalSpinControl(options.allow_spinning ? 1 : 0);
+  return Ort::Env(threading_options, ORT_LOGGING_LEVEL_WARNING, "MagikaCPP");
+}
+
+// CreateSessionOptions translates the ONNX Runtime settings of the scanner
+static Ort::SessionOptions CreateSessionOptions(const ScannerOptions& options) {
+  Ort::SessionOptions session_options;
+  session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+  session_options.SetExecutionMode(options.execution_mode == OperatorExecution::kParallel ? ORT_PARALLEL : ORT_SEQUENTIAL);
+  
+  // Thread pools of the environment replace those of the session
+  if (options.global_thread_pools) {
+    session_options.DisablePerSessionThreads();
+  } else {
+    session_options.SetIntraOpNumThreads(options.intra_op_threads);
+    session_options.SetInterOpNumThreads(options.inter_op_threads);
+    const char* spinning = options.allow_spinning ? "1" : "0";
+    session_options.AddConfigEntry(kOrtSessionOptionsConfigAllowIntraOpSpinning, spinning);
+    session_options.AddConfigEntry(kOrtSessionOptionsConfigAllowInterOpSpinning, spinning);
+  }
+  
+  if (options.cpu_arena) {
+    session_options.EnableCpuMemArena();
+  } else {
+    session_options.DisableCpuMemArena();
+  }
+  if (options.mem_pattern) {
+    session_options.EnableMemPattern();
+  } else {
+    session_options.DisableMemPattern();
+  }
+  return session_options;
+}
+
+MagikaImpl::MagikaImpl(const std::string& model_path, const Config& cfg, const ScannerOptions& scanner_options) : 
+    env(CreateEnv(scanner_options)),
+    next_session(0),
+    config(cfg),
+    layout(ComputeFeatureLayout(cfg)),
+    options(scanner_options),
+    token_type(TokenType::kInt32),
+    row_bytes(0),
+    label_count(0) {
+  
+  // A batch holds at least one input, and the pool one session
+  options.batch_size = std::max<size_t>(options.batch_size, 1);
+  options.sessions = std::max<size_t>(options.sessions, 1);
   
   // Initialize target label space
   InitTargetLabels();
   
   // Create session options
-  Ort::SessionOptions session_options;
-  session_options.SetIntraOpNumThreads(1);
-  session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+  Ort::SessionOptions session_options = CreateSessionOptions(options);
+  
+  // Sessions allocate from one arena registered with the environment. The
+  // environment is shared by the process, so an arena registered by an
+  // earlier scanner is used as it is
+  if (options.cpu_arena) {
+    session_options.AddConfigEntry(kOrtSessionOptionsConfigUseEnvAllocators, "1");
+    try {
+      Ort::MemoryInfo arena_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+      env.CreateAndRegisterAllocator(arena_info, nullptr);
+    } catch (const Ort::Exception& e) {
+      if (e.GetOrtErrorCode() != ORT_INVALID_ARGUMENT) {
+        throw;
+      }
+    }
+  }
+  
+  // Weights prepacked for the kernels are kept once for the whole pool
+  OrtPrepackedWeightsContainer* container = nullptr;
+  Ort::ThrowOnError(Ort::GetApi().CreatePrepackedWeightsContainer(&container));
+  prepacked_weights.reset(container);
   
-  // Create session
+  // Create sessions
 #ifdef _WIN32
   std::wstring ort_model_path = impl::Utf8ToWstring(model_path);
 #else
   std::string ort_model_path = model_path;
 #endif
-  session = Ort::Session(env, ort_model_path.c_str(), session_options);
+  sessions.reserve(options.sessions);
+  for (size_t i = 0; i < options.sessions; i++) {
+    sessions.emplace_back(env, ort_model_path.c_str(), session_options, prepacked_weights.get());
+  }
+  Ort::Session& session = sessions.front();
+  
+  // Rows are built in the type of the model input
+  ONNXTensorElementDataType input_type = session.GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetElementType();
+  if (input_type == ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT16) {
+    if (config.padding_token < 0 || config.padding_token > 0xffff) {
+      throw MagikaException("Padding token does not fit in the uint16 model input");
+    }
+    token_type = TokenType::kUInt16;
+  } else if (input_type == ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32) {
+    token_type = TokenType::kInt32;
+  } else {
+    throw MagikaException("Model input must be int32 or uint16 tokens");
+  }
+  row_bytes = layout.row_size * (token_type == TokenType::kUInt16 ? sizeof(uint16_t) : sizeof(int32_t));
+  
+  // Output buffers hold one score per label of each row
+  std::vector<int64_t> output_shape = session.GetOutputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
+  if (output_shape.size() == 2 && output_shape[1] > 0) {
+    label_count = static_cast<size_t>(output_shape[1]);
+  } else {
+    label_count = target_labels.size();
+  }
+}
+
+// NewContext creates a context bound to the next session of the pool
+std::unique_ptr<InferenceContext> MagikaImpl::NewContext(size_t capacity) {
+  size_t index;
+  {
+    std::lock_guard<std::mutex> lock(context_mutex);
+    index = next_session;
+    next_session = (next_session + 1) % sessions.size();
+  }
+  return std::make_unique<InferenceContext>(sessions[index], token_type, layout.row_size, label_count, capacity);
+}
+
+// AcquireContext takes a context of batch_size rows from the pool, the
+// pool grows to the number of scans running at once
+std::unique_ptr<InferenceContext> MagikaImpl::AcquireContext() {
+  {
+    std::lock_guard<std::mutex> lock(context_mutex);
+    if (!free_contexts.empty()) {
+      std::unique_ptr<InferenceContext> context = std::move(free_contexts.back());
+      free_contexts.pop_back();
+      return context;
+    }
+  }
+  return NewContext(options.batch_size);
+}
+
+void MagikaImpl::ReleaseContext(std::unique_ptr<InferenceContext> context) {
+  std::lock_guard<std::mutex> lock(context_mutex);
+  free_contexts.push_back(std::move(context));
 }
 
 void MagikaImpl::InitTargetLabels() {
@@ -75,76 +437,561 @@ void MagikaImpl::InitTargetLabels() {
   target_labels = config.target_labels_space;
 }
 
-std::pair<std::string, float> MagikaImpl::ScanFile(const std::string& filepath) {
+ReadHints MagikaImpl::GetReadHints() const {
+  ReadHints hints;
+  hints.random_access = options.reader.random_access;
+  hints.drop_cache = options.reader.drop_cache;
+  hints.no_atime = options.reader.no_atime;
+  hints.direct_io = options.reader.direct_io;
+  return hints;
+}
+
+// EmptyResult is the result of scanning an empty file
+static ScanResult EmptyResult() {
+  ScanResult result;
+  result.label = "empty";
+  result.score = 1.0f;
+  return result;
+}
+
+// LabelAndScore keeps the label and score of a result, for the pair APIs
+static std::pair<std::string, float> LabelAndScore(const ScanResult& result) {
+  return std::make_pair(result.label, result.score);
+}
+
+// ThreadRow returns the row reused by the calling thread to build the
+// features it submits to a BatchScheduler
+void* MagikaImpl::ThreadRow() {
+  static thread_local std::vector<int32_t> row;
+  row.resize(layout.row_size);
+  return row.data();
+}
+
+// ExtractFile writes the features of a file into row, and returns false
+// without touching row when the file is empty
+bool MagikaImpl::ExtractFile(const std::string& filepath, void* row, uint64_t& fingerprint) {
+  // Mappings always go through the page cache
+  if (options.reader.backend == ReaderBackend::kMapped && !options.reader.direct_io) {
+    // Map the file and extract features from views of the mapping, unless
+    // it was truncated since, reading the mapping would then raise SIGBUS
+    MappedSeekable mapped(filepath, GetReadHints());
+    if (mapped.size() == 0) {
+      return false;
+    }
+    if (!mapped.size_changed()) {
+      fingerprint = ExtractContent(mapped.data(), mapped.size(), row);
+      return true;
+    }
+  }
+  
   // Use Seekable to read file on demand
-  Seekable seekable(filepath);
+  Seekable seekable(filepath, GetReadHints());
+  if (seekable.size() == 0) {
+    return false;
+  }
+  fingerprint = ExtractSeekable(seekable, row);
+  return true;
+}
+
+// ExtractFd is ExtractFile for an open descriptor
+bool MagikaImpl::ExtractFd(int fd, void* row, uint64_t& fingerprint) {
+#ifdef _WIN32
+  (void)fd;
+  (void)row;
+  (void)fingerprint;
+  throw std::runtime_error("Scanning file descriptors is not supported on Windows");
+#else
+  // Positional reads on the caller's descriptor, which is left open
+  Seekable seekable(fd, GetReadHints());
+  if (seekable.size() == 0) {
+    return false;
+  }
+  fingerprint = ExtractSeekable(seekable, row);
+  return true;
+#endif
+}
+
+uint64_t MagikaImpl::ExtractContent(const uint8_t* data, size_t size, void* row) {
+  if (token_type == TokenType::kUInt16) {
+    return ExtractFeatures(data, size, config, layout, static_cast<uint16_t*>(row));
+  }
+  return ExtractFeatures(data, size, config, layout, static_cast<int32_t*>(row));
+}
+
+uint64_t MagikaImpl::ExtractSeekable(Seekable& seekable, void* row) {
+  if (token_type == TokenType::kUInt16) {
+    return ExtractFeaturesFromSeekable(seekable, config, layout, static_cast<uint16_t*>(row));
+  }
+  return ExtractFeaturesFromSeekable(seekable, config, layout, static_cast<int32_t*>(row));
+}
+
+uint64_t MagikaImpl::ExtractReads(const FeatureReads& reads, void* row) {
+  if (token_type == TokenType::kUInt16) {
+    return ExtractFeaturesFromReads(reads, config, layout, static_cast<uint16_t*>(row));
+  }
+  return ExtractFeaturesFromReads(reads, config, layout, static_cast<int32_t*>(row));
+}
+
+ScanResult MagikaImpl::ScanFile(const std::string& filepath) {
+  ContextLease context(*this);
+  uint64_t fingerprint = 0;
   
   // Special handling for empty files
-  if (seekable.size() == 0) {
-    return std::make_pair("empty", 1.0f);
+  if (!ExtractFile(filepath, context->Input(), fingerprint)) {
+    return EmptyResult();
+  }
+  return ScanRow(*context, fingerprint);
+}
+
+ScanResult MagikaImpl::ScanFd(int fd) {
+  ContextLease context(*this);
+  uint64_t fingerprint = 0;
+  
+  // Special handling for empty files
+  if (!ExtractFd(fd, context->Input(), fingerprint)) {
+    return EmptyResult();
+  }
+  return ScanRow(*context, fingerprint);
+}
+
+ScanResult MagikaImpl::ScanBuffer(const uint8_t* data, size_t size) {
+  // Special handling for empty buffers
+  if (size == 0) {
+    return EmptyResult();
   }
   
-  // Extract features
-  Features features = ExtractFeaturesFromSeekable(seekable, config);
-  std::vector<int32_t> flattened_features = features.Flatten();
+  // Extract features from views of the caller's buffer
+  ContextLease context(*this);
+  uint64_t fingerprint = ExtractContent(data, size, context->Input());
+  return ScanRow(*context, fingerprint);
+}
+
+ScanResult MagikaImpl::ScanStream(FeatureStream& stream) {
+  ContextLease context(*this);
+  uint64_t fingerprint;
+  if (token_type == TokenType::kUInt16) {
+    fingerprint = stream.Finish(layout, static_cast<uint16_t*>(context->Input()));
+  } else {
+    fingerprint = stream.Finish(layout, static_cast<int32_t*>(context->Input()));
+  }
+  return ScanRow(*context, fingerprint);
+}
+
+std::vector<ScanResult> MagikaImpl::ScanBuffers(const std::vector<BufferView>& buffers) {
+  std::vector<ScanResult> results(buffers.size());
+  RowBatch batch(*this);
+  for (size_t i = 0; i < buffers.size(); i++) {
+    // Special handling for empty buffers
+    if (buffers[i].size == 0) {
+      results[i] = EmptyResult();
+      continue;
+    }
+    
+    try {
+      void* row = batch.Next();
+      uint64_t fingerprint = ExtractContent(buffers[i].data, buffers[i].size, row);
+      batch.Push(&results[i], fingerprint);
+    } catch (const std::exception& e) {
+      results[i].error = e.what();
+    }
+  }
+  batch.Flush();
   
-  // Run inference
-  std::vector<float> result = RunInference(flattened_features);
+  return results;
+}
+
+std::vector<ScanResult> MagikaImpl::ScanFds(const std::vector<int>& fds) {
+  std::vector<ScanResult> results(fds.size());
+  RowBatch batch(*this);
+  for (size_t i = 0; i < fds.size(); i++) {
+    try {
+      void* row = batch.Next();
+      uint64_t fingerprint = 0;
+      if (!ExtractFd(fds[i], row, fingerprint)) {
+        results[i] = EmptyResult();
+        continue;
+      }
+      batch.Push(&results[i], fingerprint);
+    } catch (const std::exception& e) {
+      results[i].error = e.what();
+    }
+  }
+  batch.Flush();
   
-  // Find the best match
-  size_t best_index = 0;
-  for (size_t i = 1; i < result.size(); ++i) {
-    if (result[i] > result[best_index]) {
-      best_index = i;
+  return results;
+}
+
+// CopySwappedRow copies a row of a matrix written on a host of the other
+// byte order into an input row of the given token type
+static void CopySwappedRow(const FeatureMatrix& matrix, size_t i, TokenType token_type, void* row) {
+  size_t token_size = matrix.token_type == TokenType::kInt32 ? sizeof(int32_t) : sizeof(uint16_t);
+  const uint8_t* tokens = matrix.data + i * matrix.row_size * token_size;
+  for (size_t j = 0; j < matrix.row_size; j++, tokens += token_size) {
+    uint8_t swapped[sizeof(int32_t)];
+    std::reverse_copy(tokens, tokens + token_size, swapped);
+    int32_t token;
+    if (token_size == sizeof(int32_t)) {
+      std::memcpy(&token, swapped, sizeof(token));
+    } else {
+      uint16_t narrow;
+      std::memcpy(&narrow, swapped, sizeof(narrow));
+      token = narrow;
+    }
+    if (token_type == TokenType::kInt32) {
+      static_cast<int32_t*>(row)[j] = token;
+    } else {
+      static_cast<uint16_t*>(row)[j] = static_cast<uint16_t>(token);
     }
   }
+}
+
+std::vector<ScanResult> MagikaImpl::ScanFeatureMatrix(const FeatureMatrix& matrix) {
+  if (matrix.row_size != layout.row_size) {
+    throw std::runtime_error("Feature matrix rows have " + std::to_string(matrix.row_size) + " tokens, the model takes " +
+                             std::to_string(layout.row_size));
+  }
   
-  if (best_index < target_labels.size()) {
-    return std::make_pair(target_labels[best_index], result[best_index]);
-  } else {
-    return std::make_pair("unknown", result[best_index]);
+  std::vector<ScanResult> results(matrix.rows);
+  RowBatch batch(*this);
+  for (size_t i = 0; i < matrix.rows; i++) {
+    // Rows of the mapping are copied into the bound input, their tokens
+    // converted when the matrix was exported for the other input type or
+    // on a host of the other byte order
+    void* row = batch.Next();
+    if (matrix.byte_swapped) {
+      CopySwappedRow(matrix, i, token_type, row);
+    } else if (matrix.token_type == token_type) {
+      std::memcpy(row, matrix.data + i * row_bytes, row_bytes);
+    } else if (token_type == TokenType::kInt32) {
+      const uint16_t* narrow = reinterpret_cast<const uint16_t*>(matrix.data) + i * matrix.row_size;
+      std::copy(narrow, narrow + matrix.row_size, static_cast<int32_t*>(row));
+    } else {
+      const int32_t* wide = reinterpret_cast<const int32_t*>(matrix.data) + i * matrix.row_size;
+      uint16_t* narrow = static_cast<uint16_t*>(row);
+      for (size_t j = 0; j < matrix.row_size; j++) {
+        narrow[j] = static_cast<uint16_t>(wide[j]);
+      }
+    }
+    batch.Push(&results[i], 0);
   }
+  batch.Flush();
+  
+  return results;
 }
 
-std::vector<float> MagikaImpl::RunInference(const std::vector<int32_t>& features) {
-  // Define input and output names
-  const char* input_names[] = { "bytes" };
-  const char* output_names[] = { "target_label" };
+std::vector<ScanResult> MagikaImpl::ScanRanges(Seekable& seekable, const std::vector<ByteRange>& ranges) {
+  std::vector<ScanResult> results(ranges.size());
   
-  // Create input tensor
-  std::vector<int64_t> input_shape = { 1, static_cast<int64_t>(features.size()) };
-  auto memory_info = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
-  Ort::Value input_tensor = Ort::Value::CreateTensor<int32_t>(
-      memory_info, 
-      const_cast<int32_t*>(features.data()), 
-      features.size(), 
-      input_shape.data(), 
-      input_shape.size()
-  );
-  try {
-    // Run inference
-    std::vector<Ort::Value> output_tensors = session.Run(
-        Ort::RunOptions{nullptr}, 
-        input_names, 
-        &input_tensor, 
-        1, 
-        output_names, 
-        1
-    );
-    // Get output
-    std::vector<float> result;
-    if (output_tensors.size() > 0) {
-      auto info = output_tensors.front().GetTensorTypeAndShapeInfo();
-      size_t output_count = info.GetElementCount();
+  // Visit the ranges in file order so that reads move forward through the file
+  std::vector<size_t> order(ranges.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return ranges[a].offset < ranges[b].offset;
+  });
+  
+  // Several ranges are planned together so that their reads share syscalls
+  const size_t kRangesPerRead = 16;
+  std::vector<FeatureReads> reads(kRangesPerRead);
+  std::vector<ReadRange> read_batch;
+  RowBatch batch(*this);
+  
+  for (size_t start = 0; start < order.size(); start += kRangesPerRead) {
+    size_t count = std::min<size_t>(kRangesPerRead, order.size() - start);
+    
+    read_batch.clear();
+    for (size_t k = 0; k < count; k++) {
+      const ByteRange& range = ranges[order[start + k]];
+      if (range.offset > seekable.size() || range.length > seekable.size() - range.offset) {
+        results[order[start + k]].error = "Range exceeds file boundaries";
+        continue;
+      }
+      PlanFeatureReads(range.length, config, reads[k], range.offset);
+      read_batch.insert(read_batch.end(), reads[k].ranges, reads[k].ranges + reads[k].range_count);
+    }
+    
+    std::string read_error;
+    try {
+      seekable.read_ranges(read_batch.data(), read_batch.size());
+    } catch (const std::exception& e) {
+      read_error = e.what();
+    }
+    
+    for (size_t k = 0; k < count; k++) {
+      ScanResult& result = results[order[start + k]];
+      if (!result.error.empty()) {
+        continue;
+      }
+      if (!read_error.empty()) {
+        result.error = read_error;
+        continue;
+      }
+      
+      // Special handling for empty ranges
+      if (reads[k].content_size == 0) {
+        result = EmptyResult();
+        continue;
+      }
+      
+      try {
+        void* row = batch.Next();
+        uint64_t fingerprint = ExtractReads(reads[k], row);
+        batch.Push(&result, fingerprint);
+      } catch (const std::exception& e) {
+        result.error = e.what();
+      }
+    }
+  }
+  batch.Flush();
+  
+  return results;
+}
+
+std::vector<ScanResult> MagikaImpl::ScanFiles(const std::vector<std::string>& filepaths) {
+  std::vector<ScanResult> results(filepaths.size());
+  RowBatch batch(*this);
+  
+  if (options.reader.backend != ReaderBackend::kIoUring) {
+    for (size_t i = 0; i < filepaths.size(); i++) {
+      try {
+        void* row = batch.Next();
+        uint64_t fingerprint = 0;
+        if (!ExtractFile(filepaths[i], row, fingerprint)) {
+          results[i] = EmptyResult();
+          continue;
+        }
+        batch.Push(&results[i], fingerprint);
+      } catch (const std::exception& e) {
+        results[i].error = e.what();
+      }
+    }
+    batch.Flush();
+    return results;
+  }
+  
+  // Read files in batches and extract each one as soon as its ranges arrive,
+  // the model runs whenever batch_size rows are ready
+  BatchReader reader(config, options.reader.io_uring_queue_depth, GetReadHints());
+  reader.Read(filepaths, [&](const BatchItem& item) {
+    ScanResult& result = results[item.index];
+    if (!item.error.empty()) {
+      result.error = item.error;
+      return;
+    }
+    
+    // Special handling for empty files
+    if (item.reads->content_size == 0) {
+      result = EmptyResult();
+      return;
+    }
+    
+    try {
+      void* row = batch.Next();
+      uint64_t fingerprint = ExtractReads(*item.reads, row);
+      batch.Push(&result, fingerprint);
+    } catch (const std::exception& e) {
+      result.error = e.what();
+    }
+  });
+  batch.Flush();
+  
+  return results;
+}
+
+ScanResult MagikaImpl::ScanRow(InferenceContext& context, uint64_t fingerprint) {
+  ScanResult result;
+  result.fingerprint = fingerprint;
+  ScanResult* results[] = { &result };
+  InferRows(context, 1, results);
+  return result;
+}
 
-      float* output_data = output_tensors.front().GetTensorMutableData<float>();
-      result.assign(output_data, output_data + output_count);
+// InferRows runs the model on the first count rows of the context and
+// sets the label and score of their results
+void MagikaImpl::InferRows(InferenceContext& context, size_t count, ScanResult* const* results) {
+  const float* scores;
+  try {
+    scores = context.Run(count);
+  } catch (const Ort::Exception& e) {
+    throw std::runtime_error(std::string("Model inference failed: ") + e.what());
+  }
+  
+  for (size_t i = 0; i < count; i++) {
+    const float* row_scores = scores + i * label_count;
+    
+    // Find the best match
+    size_t best_index = 0;
+    for (size_t j = 1; j < label_count; ++j) {
+      if (row_scores[j] > row_scores[best_index]) {
+        best_index = j;
+      }
     }
+    
+    results[i]->label = best_index < target_labels.size() ? target_labels[best_index] : "unknown";
+    results[i]->score = row_scores[best_index];
+  }
+}
+
+/**
+ * BatchScheduler coalesces single inputs submitted by many threads into
+ * batched runs of the model. Callers build the features of their input in
+ * their own thread and copy the row into the pending batch; a worker
+ * thread runs the pending batch once it holds max_batch rows or its oldest
+ * row has waited max_wait_us, while callers fill the next one.
+ */
+class BatchScheduler {
+ private:
+  typedef std::chrono::steady_clock Clock;
+  
+  MagikaImpl& impl;
+  BatchSchedulerOptions options;
+  std::mutex mutex;
+  // Signaled when rows are queued or the scheduler stops
+  std::condition_variable queued;
+  // Signaled when the worker takes the pending batch
+  std::condition_variable taken;
+  // Rows waiting for the worker, their promises and when they were queued
+  std::unique_ptr<InferenceContext> pending_context;
+  std::vector<std::promise<ScanResult>> pending_promises;
+  std::vector<uint64_t> pending_fingerprints;
+  std::vector<Clock::time_point> pending_times;
+  // Batch being run by the worker, swapped with the pending one
+  std::unique_ptr<InferenceContext> running_context;
+  std::vector<std::promise<ScanResult>> running_promises;
+  std::vector<uint64_t> running_fingerprints;
+  std::vector<Clock::time_point> running_times;
+  std::vector<ScanResult> running_results;
+  std::vector<ScanResult*> running_pointers;
+  BatchSchedulerStats stats;
+  bool stopping;
+  std::thread worker;
+  
+  void Run();
+  
+ public:
+  BatchScheduler(MagikaImpl& magika, const BatchSchedulerOptions& scheduler_options);
+  
+  ~BatchScheduler();
+  
+  std::future<ScanResult> Submit(const void* row, uint64_t fingerprint);
+  
+  BatchSchedulerStats GetStats();
+};
+
+BatchScheduler::BatchScheduler(MagikaImpl& magika, const BatchSchedulerOptions& scheduler_options) :
+    impl(magika),
+    options(scheduler_options),
+    stopping(false) {
+  
+  // A batch holds at least one input
+  options.max_batch = std::max<size_t>(options.max_batch, 1);
+  
+  // Rows are copied straight into the bound input of the pending batch
+  pending_context = impl.NewContext(options.max_batch);
+  running_context = impl.NewContext(options.max_batch);
+  pending_promises.reserve(options.max_batch);
+  running_promises.reserve(options.max_batch);
+  pending_fingerprints.reserve(options.max_batch);
+  running_fingerprints.reserve(options.max_batch);
+  pending_times.reserve(options.max_batch);
+  running_times.reserve(options.max_batch);
+  running_results.reserve(options.max_batch);
+  running_pointers.reserve(options.max_batch);
+  
+  worker = std::thread(&BatchScheduler::Run, this);
+}
+
+BatchScheduler::~BatchScheduler() {
+  // The worker runs what is still pending before it exits
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  queued.notify_all();
+  worker.join();
+}
+
+std::future<ScanResult> BatchScheduler::Submit(const void* row, uint64_t fingerprint) {
+  std::unique_lock<std::mutex> lock(mutex);
+  
+  // Wait for room while the pending batch is full and the worker is busy
+  taken.wait(lock, [&] { return pending_promises.size() < options.max_batch; });
+  
+  uint8_t* slot = static_cast<uint8_t*>(pending_context->Input()) + pending_promises.size() * impl.GetRowBytes();
+  std::memcpy(slot, row, impl.GetRowBytes());
+  pending_promises.emplace_back();
+  pending_fingerprints.push_back(fingerprint);
+  pending_times.push_back(Clock::now());
+  std::future<ScanResult> future = pending_promises.back().get_future();
+  
+  // The worker waits for the first row of a batch and for a full batch
+  if (pending_promises.size() == 1 || pending_promises.size() == options.max_batch) {
+    queued.notify_one();
+  }
+  return future;
+}
+
+BatchSchedulerStats BatchScheduler::GetStats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
 
-    return result;
-  } catch(const Ort::Exception& e) {
-    std::cout << "run exception:" << e.GetOrtErrorCode() << ", msg:" << e.what() << std::endl;
-    return {};
+void BatchScheduler::Run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    queued.wait(lock, [&] { return stopping || !pending_promises.empty(); });
+    if (pending_promises.empty()) {
+      return;
+    }
+    
+    // Wait for a full batch until the oldest row reaches its deadline
+    Clock::time_point deadline = pending_times.front() + std::chrono::microseconds(options.max_wait_us);
+    queued.wait_until(lock, deadline, [&] { return stopping || pending_promises.size() >= options.max_batch; });
+    
+    // Take the pending batch, callers fill the other one meanwhile
+    Clock::time_point dispatched = Clock::now();
+    size_t count = pending_promises.size();
+    pending_context.swap(running_context);
+    pending_promises.swap(running_promises);
+    pending_fingerprints.swap(running_fingerprints);
+    pending_times.swap(running_times);
+    
+    stats.batches++;
+    stats.requests += count;
+    stats.max_batch_size = std::max<size_t>(stats.max_batch_size, count);
+    if (count == options.max_batch) {
+      stats.full_batches++;
+    }
+    for (const Clock::time_point& time : running_times) {
+      uint64_t wait_us = std::chrono::duration_cast<std::chrono::microseconds>(dispatched - time).count();
+      stats.total_queue_wait_us += wait_us;
+      stats.max_queue_wait_us = std::max<uint64_t>(stats.max_queue_wait_us, wait_us);
+    }
+    lock.unlock();
+    taken.notify_all();
+    
+    running_results.assign(count, ScanResult());
+    running_pointers.clear();
+    for (size_t i = 0; i < count; i++) {
+      running_results[i].fingerprint = running_fingerprints[i];
+      running_pointers.push_back(&running_results[i]);
+    }
+    
+    // A failed run fails each input of the batch
+    try {
+      impl.InferRows(*running_context, count, running_pointers.data());
+    } catch (const std::exception& e) {
+      for (ScanResult& result : running_results) {
+        result.error = e.what();
+      }
+    }
+    for (size_t i = 0; i < count; i++) {
+      running_promises[i].set_value(std::move(running_results[i]));
+    }
+    
+    lock.lock();
+    running_promises.clear();
+    running_fingerprints.clear();
+    running_times.clear();
   }
 }
 
@@ -152,6 +999,16 @@ std::vector<float> MagikaImpl::RunInference(const std::vector<int32_t>& features
 static std::unique_ptr<MagikaImpl> g_magika_impl = nullptr;
 
 void MagikaScanner::initialize(const std::string& model_path) {
+  initialize(model_path, ReaderOptions());
+}
+
+void MagikaScanner::initialize(const std::string& model_path, const ReaderOptions& reader_options) {
+  ScannerOptions options;
+  options.reader = reader_options;
+  initialize(model_path, options);
+}
+
+void MagikaScanner::initialize(const std::string& model_path, const ScannerOptions& options) {
   // Infer asset directory and model name from model path
   std::string assets_dir = "."; // Default to current directory
   std::string model_name = "standard_v3_3"; // Default model name
@@ -170,8 +1027,12 @@ void MagikaScanner::initialize(const std::string& model_path) {
   // Read configuration
   Config cfg = Config::ReadConfig(assets_dir, model_name);
   
+  // Release the previous scanner first, so that its environment is not
+  // reused with other thread pools than the ones asked for
+  g_magika_impl.reset();
+  
   // Initialize MagikaImpl
-  g_magika_impl = std::make_unique<MagikaImpl>(model_path, cfg);
+  g_magika_impl = std::make_unique<MagikaImpl>(model_path, cfg, options);
 }
 
 std::string MagikaScanner::scanFile(const std::string& filepath) {
@@ -179,14 +1040,227 @@ std::string MagikaScanner::scanFile(const std::string& filepath) {
     throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
   }
   
-  std::pair<std::string, float> result = g_magika_impl->ScanFile(filepath);
-  return result.first;
+  return g_magika_impl->ScanFile(filepath).label;
 }
 
 std::pair<std::string, float> MagikaScanner::scanFileWithScore(const std::string& filepath) {
+  return LabelAndScore(scanFileWithFingerprint(filepath));
+}
+
+ScanResult MagikaScanner::scanFileWithFingerprint(const std::string& filepath) {
   if (!g_magika_impl) {
     throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
   }
   
   return g_magika_impl->ScanFile(filepath);
-}
\ No newline at end of file
+}
+
+std::vector<ScanResult> MagikaScanner::scanFiles(const std::vector<std::string>& filepaths) {
+  if (!g_magika_impl) {
+    throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
+  }
+  
+  return g_magika_impl->ScanFiles(filepaths);
+}
+
+std::string MagikaScanner::scanBuffer(const uint8_t* data, size_t size) {
+  return scanBufferWithScore(data, size).first;
+}
+
+std::pair<std::string, float> MagikaScanner::scanBufferWithScore(const uint8_t* data, size_t size) {
+  return LabelAndScore(scanBufferWithFingerprint(data, size));
+}
+
+std::pair<std::string, float> MagikaScanner::scanBufferWithScore(const std::vector<uint8_t>& buffer) {
+  return scanBufferWithScore(buffer.data(), buffer.size());
+}
+
+ScanResult MagikaScanner::scanBufferWithFingerprint(const uint8_t* data, size_t size) {
+  if (!g_magika_impl) {
+    throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
+  }
+  
+  return g_magika_impl->ScanBuffer(data, size);
+}
+
+std::vector<ScanResult> MagikaScanner::scanBuffers(const std::vector<BufferView>& buffers) {
+  if (!g_magika_impl) {
+    throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
+  }
+  
+  return g_magika_impl->ScanBuffers(buffers);
+}
+
+MagikaStreamScanner::MagikaStreamScanner() {
+  if (!g_magika_impl) {
+    throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
+  }
+  
+  try {
+    stream = std::make_unique<FeatureStream>(g_magika_impl->GetConfig());
+  } catch (const std::exception& e) {
+    throw MagikaException(e.what());
+  }
+}
+
+MagikaStreamScanner::~MagikaStreamScanner() = default;
+
+void MagikaStreamScanner::push(const uint8_t* data, size_t size) {
+  stream->Push(data, size);
+}
+
+std::pair<std::string, float> MagikaStreamScanner::finish() {
+  if (!g_magika_impl) {
+    throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
+  }
+  
+  // Special handling for empty streams
+  if (stream->size() == 0) {
+    return std::make_pair("empty", 1.0f);
+  }
+  
+  ScanResult result = g_magika_impl->ScanStream(*stream);
+  stream->Reset();
+  return LabelAndScore(result);
+}
+
+// SingleRangeResult unwraps the result of scanning a single range
+static std::pair<std::string, float> SingleRangeResult(const std::vector<ScanResult>& results) {
+  if (!results[0].error.empty()) {
+    throw MagikaException(results[0].error);
+  }
+  
+  return LabelAndScore(results[0]);
+}
+
+std::pair<std::string, float> MagikaScanner::scanRange(const std::string& filepath, size_t offset, size_t length) {
+  return SingleRangeResult(scanRanges(filepath, { ByteRange{ offset, length } }));
+}
+
+std::vector<ScanResult> MagikaScanner::scanRanges(const std::string& filepath, const std::vector<ByteRange>& ranges) {
+  if (!g_magika_impl) {
+    throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
+  }
+  
+  try {
+    Seekable seekable(filepath, g_magika_impl->GetReadHints());
+    return g_magika_impl->ScanRanges(seekable, ranges);
+  } catch (const std::exception& e) {
+    throw MagikaException(e.what());
+  }
+}
+
+std::vector<ScanResult> MagikaScanner::scanFeatureMatrix(const std::string& matrix_path) {
+  if (!g_magika_impl) {
+    throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
+  }
+  
+  try {
+    // Rows are read in order, leave readahead on
+    ReadHints hints;
+    hints.random_access = false;
+    MappedSeekable mapped(matrix_path, hints);
+    FeatureMatrix matrix;
+    ParseFeatureMatrix(mapped.data(), mapped.size(), matrix);
+    return g_magika_impl->ScanFeatureMatrix(matrix);
+  } catch (const std::exception& e) {
+    throw MagikaException(e.what());
+  }
+}
+
+#ifndef _WIN32
+std::string MagikaScanner::scanFd(int fd) {
+  return scanFdWithScore(fd).first;
+}
+
+std::pair<std::string, float> MagikaScanner::scanFdWithScore(int fd) {
+  if (!g_magika_impl) {
+    throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
+  }
+  
+  try {
+    return LabelAndScore(g_magika_impl->ScanFd(fd));
+  } catch (const std::exception& e) {
+    throw MagikaException(e.what());
+  }
+}
+
+std::vector<ScanResult> MagikaScanner::scanFds(const std::vector<int>& fds) {
+  if (!g_magika_impl) {
+    throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
+  }
+  
+  return g_magika_impl->ScanFds(fds);
+}
+
+std::pair<std::string, float> MagikaScanner::scanRange(int fd, size_t offset, size_t length) {
+  return SingleRangeResult(scanRanges(fd, { ByteRange{ offset, length } }));
+}
+
+std::vector<ScanResult> MagikaScanner::scanRanges(int fd, const std::vector<ByteRange>& ranges) {
+  if (!g_magika_impl) {
+    throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
+  }
+  
+  try {
+    Seekable seekable(fd, g_magika_impl->GetReadHints());
+    return g_magika_impl->ScanRanges(seekable, ranges);
+  } catch (const std::exception& e) {
+    throw MagikaException(e.what());
+  }
+}
+#endif
+// ReadyResult wraps a result known without running the model
+static std::future<ScanResult> ReadyResult(const ScanResult& result) {
+  std::promise<ScanResult> promise;
+  promise.set_value(result);
+  return promise.get_future();
+}
+
+MagikaBatchScheduler::MagikaBatchScheduler(const BatchSchedulerOptions& options) {
+  if (!g_magika_impl) {
+    throw MagikaException("MagikaScanner not initialized. Call initialize() first.");
+  }
+  
+  scheduler = std::make_unique<BatchScheduler>(*g_magika_impl, options);
+}
+
+MagikaBatchScheduler::~MagikaBatchScheduler() = default;
+
+std::future<ScanResult> MagikaBatchScheduler::scanFile(const std::string& filepath) {
+  ScanResult result;
+  try {
+    void* row = g_magika_impl->ThreadRow();
+    uint64_t fingerprint = 0;
+    
+    // Special handling for empty files
+    if (!g_magika_impl->ExtractFile(filepath, row, fingerprint)) {
+      return ReadyResult(EmptyResult());
+    }
+    return scheduler->Submit(row, fingerprint);
+  } catch (const std::exception& e) {
+    result.error = e.what();
+  }
+  return ReadyResult(result);
+}
+
+std::future<ScanResult> MagikaBatchScheduler::scanBuffer(const uint8_t* data, size_t size) {
+  // Special handling for empty buffers
+  if (size == 0) {
+    return ReadyResult(EmptyResult());
+  }
+  
+  ScanResult result;
+  try {
+    void* row = g_magika_impl->ThreadRow();
+    uint64_t fingerprint = g_magika_impl->ExtractContent(data, size, row);
+    return scheduler->Submit(row, fingerprint);
+  } catch (const std::exception& e) {
+    result.error = e.what();
+  }
+  return ReadyResult(result);
+}
+
+BatchSchedulerStats MagikaBatchScheduler::stats() const {
+  return scheduler->GetStats();
+}
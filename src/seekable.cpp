@@ -2,8 +2,160 @@
 #include <stdexcept>
 #include <algorithm>
 #include <iterator>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <new>
 
-Seekable::Seekable(const std::string& filepath) : file_size(0) {
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+// Maximum number of iovecs submitted in one preadv
+static const int kMaxReadIovecs = 64;
+
+// Maximum number of ranges sorted together by read_ranges
+static const size_t kMaxSortedRanges = 32;
+
+// Reads on descriptors opened with O_DIRECT start and end on this boundary,
+// which is a multiple of the logical block size of common devices
+static const size_t kDirectAlignment = 4096;
+
+// PreadvFully reads all the iovecs starting at offset, retrying on short reads.
+static void PreadvFully(int fd, struct iovec* iov, int iovcnt, size_t offset) {
+  while (iovcnt > 0) {
+    ssize_t n = preadv(fd, iov, iovcnt, static_cast<off_t>(offset));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("Failed to read file: ") + std::strerror(errno));
+    }
+    if (n == 0) {
+      throw std::runtime_error("Unexpected end of file");
+    }
+    
+    // Skip the iovecs that were filled completely
+    offset += static_cast<size_t>(n);
+    size_t remaining = static_cast<size_t>(n);
+    while (iovcnt > 0 && remaining >= iov->iov_len) {
+      remaining -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+      iov->iov_len -= remaining;
+    }
+  }
+}
+#endif
+
+#ifndef _WIN32
+// OpenWithFlags opens the file, with O_NOATIME when asked for and permitted
+// (only the file owner or CAP_FOWNER may use it)
+static int OpenWithFlags(const std::string& filepath, int flags, bool no_atime) {
+#ifdef O_NOATIME
+  if (no_atime) {
+    int fd = open(filepath.c_str(), flags | O_NOATIME);
+    if (fd >= 0 || errno != EPERM) {
+      return fd;
+    }
+  }
+#else
+  (void)no_atime;
+#endif
+  return open(filepath.c_str(), flags);
+}
+
+// OpenForReading opens the file read-only with the flags asked for by the
+// hints, dropping O_DIRECT on filesystems that reject it
+static int OpenForReading(const std::string& filepath, const ReadHints& hints) {
+#ifdef O_DIRECT
+  if (hints.direct_io) {
+    int fd = OpenWithFlags(filepath, O_RDONLY | O_CLOEXEC | O_DIRECT, hints.no_atime);
+    if (fd >= 0 || errno != EINVAL) {
+      return fd;
+    }
+  }
+#endif
+  return OpenWithFlags(filepath, O_RDONLY | O_CLOEXEC, hints.no_atime);
+}
+
+// IsDirect tells whether the descriptor bypasses the page cache
+static bool IsDirect(int fd) {
+#ifdef O_DIRECT
+  int flags = fcntl(fd, F_GETFL);
+  return flags >= 0 && (flags & O_DIRECT) != 0;
+#else
+  (void)fd;
+  return false;
+#endif
+}
+
+// ClearDirect switches the descriptor back to reads through the page cache
+static void ClearDirect(int fd) {
+#ifdef O_DIRECT
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_DIRECT) != 0) {
+    throw std::runtime_error(std::string("Failed to disable direct I/O: ") + std::strerror(errno));
+  }
+#else
+  (void)fd;
+#endif
+}
+
+// BounceBuffer returns a buffer of at least size bytes aligned for O_DIRECT,
+// reused by the calling thread
+static uint8_t* BounceBuffer(size_t size) {
+  struct Buffer {
+    void* data = nullptr;
+    size_t capacity = 0;
+    ~Buffer() { free(data); }
+  };
+  static thread_local Buffer buffer;
+  
+  if (buffer.capacity < size) {
+    void* data = nullptr;
+    if (posix_memalign(&data, kDirectAlignment, size) != 0) {
+      throw std::bad_alloc();
+    }
+    free(buffer.data);
+    buffer.data = data;
+    buffer.capacity = size;
+  }
+  return static_cast<uint8_t*>(buffer.data);
+}
+
+// AdviseRandom disables readahead on the file, failures are harmless
+static void AdviseRandom(int fd) {
+#ifdef POSIX_FADV_RANDOM
+  posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+#else
+  (void)fd;
+#endif
+}
+
+// AdviseDontNeed drops the file's pages from the page cache, failures are
+// harmless
+static void AdviseDontNeed(int fd) {
+#ifdef POSIX_FADV_DONTNEED
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#else
+  (void)fd;
+#endif
+}
+#endif
+
+Seekable::Seekable(const std::string& filepath, const ReadHints& hints) : file_size(0), drop_cache(hints.drop_cache) {
+#ifdef _WIN32
   // Open file stream
   file_stream = std::make_unique<std::ifstream>(filepath, std::ios::binary);
   if (!file_stream->is_open()) {
@@ -14,12 +166,63 @@ Seekable::Seekable(const std::string& filepath) : file_size(0) {
   file_stream->seekg(0, std::ios::end);
   file_size = static_cast<size_t>(file_stream->tellg());
   file_stream->seekg(0, std::ios::beg);
+#else
+  // Open a raw descriptor, all reads are positional
+  owns_fd = true;
+  fd = OpenForReading(filepath, hints);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot open file: " + filepath);
+  }
+  direct_io = hints.direct_io && IsDirect(fd);
+  
+  // Get file size
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("Cannot get file size: " + filepath);
+  }
+  file_size = static_cast<size_t>(st.st_size);
+  
+  // Only a few blocks are read, readahead would fetch pages for nothing
+  if (hints.random_access) {
+    AdviseRandom(fd);
+  }
+#endif
 }
 
+#ifndef _WIN32
+Seekable::Seekable(int descriptor, const ReadHints& hints) :
+    fd(descriptor),
+    owns_fd(false),
+    direct_io(IsDirect(descriptor)),
+    file_size(0),
+    drop_cache(hints.drop_cache) {
+  // Get file size
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    throw std::runtime_error("Cannot get file size of descriptor " + std::to_string(fd));
+  }
+  // Pipes, sockets and devices report no size, they would pass for empty
+  if (!S_ISREG(st.st_mode)) {
+    throw std::runtime_error("Descriptor " + std::to_string(fd) + " is not a regular file");
+  }
+  file_size = static_cast<size_t>(st.st_size);
+}
+#endif
+
 Seekable::~Seekable() {
+#ifdef _WIN32
   if (file_stream && file_stream->is_open()) {
     file_stream->close();
   }
+#else
+  if (drop_cache) {
+    AdviseDontNeed(fd);
+  }
+  if (owns_fd) {
+    close(fd);
+  }
+#endif
 }
 
 size_t Seekable::size() const {
@@ -35,12 +238,251 @@ std::vector<uint8_t> Seekable::read_at(size_t offset, size_t size) {
     throw std::out_of_range("Read request exceeds file boundaries");
   }
   
-  // Position to the specified offset
-  file_stream->seekg(static_cast<std::streamoff>(offset));
-  
-  // Read data
   std::vector<uint8_t> buffer(size);
-  file_stream->read(reinterpret_cast<char*>(buffer.data()), size);
+  read_into(offset, buffer.data(), size);
   
   return buffer;
-}
\ No newline at end of file
+}
+
+void Seekable::read_into(size_t offset, uint8_t* buffer, size_t size) {
+  ReadRange range = { offset, size, buffer };
+  read_ranges(&range, 1);
+}
+
+void Seekable::read_ranges(const ReadRange* ranges, size_t count, size_t max_gap) {
+#ifndef _WIN32
+  // Ranges are sorted on the stack, larger requests are split in chunks
+  if (count > kMaxSortedRanges) {
+    read_ranges(ranges, kMaxSortedRanges, max_gap);
+    read_ranges(ranges + kMaxSortedRanges, count - kMaxSortedRanges, max_gap);
+    return;
+  }
+#else
+  (void)max_gap;
+#endif
+  
+  for (size_t i = 0; i < count; i++) {
+    if (ranges[i].offset + ranges[i].size > file_size) {
+      throw std::out_of_range("Read request exceeds file boundaries");
+    }
+  }
+  
+#ifdef _WIN32
+  for (size_t i = 0; i < count; i++) {
+    if (ranges[i].size == 0) {
+      continue;
+    }
+    
+    // Position to the specified offset and read data
+    file_stream->seekg(static_cast<std::streamoff>(ranges[i].offset));
+    file_stream->read(reinterpret_cast<char*>(ranges[i].buffer), ranges[i].size);
+  }
+#else
+  // Sort the non-empty ranges by offset so that neighbours can share a preadv
+  const ReadRange* order[kMaxSortedRanges];
+  size_t order_count = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (ranges[i].size > 0) {
+      order[order_count++] = &ranges[i];
+    }
+  }
+  std::sort(order, order + order_count, [](const ReadRange* a, const ReadRange* b) {
+    return a->offset < b->offset;
+  });
+  
+  if (direct_io) {
+    if (read_ranges_direct(order, order_count, max_gap)) {
+      return;
+    }
+    
+    // The filesystem accepted O_DIRECT when opening but rejects the reads,
+    // continue through the page cache unless the descriptor is the caller's
+    if (!owns_fd) {
+      throw std::runtime_error("Failed to read file: direct I/O rejected by the filesystem");
+    }
+    ClearDirect(fd);
+    direct_io = false;
+  }
+  
+  // Bytes in the gaps between coalesced ranges are read and discarded here
+  static thread_local std::vector<uint8_t> gap_buffer;
+  if (gap_buffer.size() < max_gap) {
+    gap_buffer.resize(max_gap);
+  }
+  
+  struct iovec iov[kMaxReadIovecs];
+  size_t i = 0;
+  while (i < order_count) {
+    size_t group_offset = order[i]->offset;
+    size_t group_end = group_offset + order[i]->size;
+    int iovcnt = 0;
+    iov[iovcnt++] = { order[i]->buffer, order[i]->size };
+    
+    // Extend the group with following ranges as long as they do not overlap
+    // it and the gap in between is small enough to be worth reading
+    size_t j = i + 1;
+    while (j < order_count && iovcnt + 2 <= kMaxReadIovecs) {
+      const ReadRange* next = order[j];
+      if (next->offset < group_end || next->offset - group_end > max_gap) {
+        break;
+      }
+      if (next->offset > group_end) {
+        iov[iovcnt++] = { gap_buffer.data(), next->offset - group_end };
+      }
+      iov[iovcnt++] = { next->buffer, next->size };
+      group_end = next->offset + next->size;
+      j++;
+    }
+    
+    PreadvFully(fd, iov, iovcnt, group_offset);
+    i = j;
+  }
+#endif
+}
+
+#ifndef _WIN32
+bool Seekable::read_ranges_direct(const ReadRange* const* order, size_t count, size_t max_gap) {
+  size_t i = 0;
+  while (i < count) {
+    // Ranges whose aligned spans are close enough are read together, they
+    // may overlap as they are all sliced out of the bounce buffer
+    size_t group_offset = order[i]->offset / kDirectAlignment * kDirectAlignment;
+    size_t group_end = order[i]->offset + order[i]->size;
+    size_t j = i + 1;
+    while (j < count && order[j]->offset <= group_end + max_gap) {
+      group_end = std::max(group_end, order[j]->offset + order[j]->size);
+      j++;
+    }
+    
+    // Over-read up to the alignment boundary, the kernel stops at the end
+    // of the file
+    size_t needed = group_end - group_offset;
+    size_t aligned_size = (needed + kDirectAlignment - 1) / kDirectAlignment * kDirectAlignment;
+    uint8_t* bounce = BounceBuffer(aligned_size);
+    size_t done = 0;
+    while (done < needed) {
+      ssize_t n = pread(fd, bounce + done, aligned_size - done, static_cast<off_t>(group_offset + done));
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EINVAL && done == 0) {
+          return false;
+        }
+        throw std::runtime_error(std::string("Failed to read file: ") + std::strerror(errno));
+      }
+      if (n == 0) {
+        throw std::runtime_error("Unexpected end of file");
+      }
+      done += static_cast<size_t>(n);
+    }
+    
+    // Slice the exact windows out of the bounce buffer
+    for (size_t k = i; k < j; k++) {
+      std::memcpy(order[k]->buffer, bounce + (order[k]->offset - group_offset), order[k]->size);
+    }
+    i = j;
+  }
+  
+  return true;
+}
+#endif
+
+MappedSeekable::MappedSeekable(const std::string& filepath, const ReadHints& hints) : mapped_data(nullptr), file_size(0) {
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error("Cannot open file: " + filepath);
+  }
+  
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    throw std::runtime_error("Cannot get file size: " + filepath);
+  }
+  file_size = static_cast<size_t>(size.QuadPart);
+  
+  // Empty files cannot be mapped, there is nothing to read anyway
+  if (file_size > 0) {
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping != nullptr) {
+      mapped_data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+      // The view keeps the mapping alive
+      CloseHandle(mapping);
+    }
+  }
+  CloseHandle(file);
+  (void)hints;
+#else
+  fd = OpenForReading(filepath, hints);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot open file: " + filepath);
+  }
+  drop_cache = hints.drop_cache;
+  
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("Cannot get file size: " + filepath);
+  }
+  file_size = static_cast<size_t>(st.st_size);
+  
+  // Empty files cannot be mapped, there is nothing to read anyway
+  if (file_size > 0) {
+    void* addr = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      mapped_data = static_cast<const uint8_t*>(addr);
+      
+      // Only a few blocks are touched, page faults should not read ahead
+      if (hints.random_access) {
+        madvise(addr, file_size, MADV_RANDOM);
+      }
+    }
+  }
+  
+  if (mapped_data == nullptr) {
+    close(fd);
+    fd = -1;
+  }
+#endif
+  
+  if (file_size > 0 && mapped_data == nullptr) {
+    throw std::runtime_error("Cannot map file: " + filepath);
+  }
+}
+
+MappedSeekable::~MappedSeekable() {
+#ifdef _WIN32
+  if (mapped_data != nullptr) {
+    UnmapViewOfFile(mapped_data);
+  }
+#else
+  if (mapped_data != nullptr) {
+    munmap(const_cast<uint8_t*>(mapped_data), file_size);
+  }
+  if (fd >= 0) {
+    if (drop_cache) {
+      AdviseDontNeed(fd);
+    }
+    close(fd);
+  }
+#endif
+}
+
+size_t MappedSeekable::size() const {
+  return file_size;
+}
+
+const uint8_t* MappedSeekable::data() const {
+  return mapped_data;
+}
+
+bool MappedSeekable::size_changed() const {
+#ifdef _WIN32
+  return false;
+#else
+  struct stat st;
+  return fd >= 0 && (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != file_size);
+#endif
+}
@@ -0,0 +1,141 @@
+// Allocation test of the feature extraction paths: once the per-thread
+// buffers and the reused Features are warmed up, extracting the features
+// of a file must not allocate from the heap.
+#include "filefeatures.h"
+#include "seekable.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::atomic<size_t> g_allocations(0);
+
+void* operator new(size_t size) {
+  g_allocations++;
+  void* p = std::malloc(size > 0 ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+// Sizes of the test files, from empty to larger than every window
+static const size_t kSizes[] = { 0, 1, 1000, 4096, 5000, 0x8004, 0x9808, 100000 };
+
+// Rounds over the files once warmed up
+static const int kRounds = 10;
+
+// CountAllocations runs extract on every file after a warm-up round, and
+// returns the heap allocations per file
+static double CountAllocations(const std::vector<std::string>& paths, const std::function<void(size_t)>& extract) {
+  for (size_t i = 0; i < paths.size(); i++) {
+    extract(i);
+  }
+  size_t before = g_allocations;
+  for (int round = 0; round < kRounds; round++) {
+    for (size_t i = 0; i < paths.size(); i++) {
+      extract(i);
+    }
+  }
+  return static_cast<double>(g_allocations - before) / (kRounds * paths.size());
+}
+
+int main() {
+  Config cfg;
+  cfg.beg_size = k_beg_size;
+  cfg.mid_size = 512;
+  cfg.end_size = k_end_size;
+  cfg.padding_token = k_padding_token;
+  cfg.block_size = k_block_size;
+  cfg.use_inputs_at_offsets = true;
+  FeatureLayout layout = ComputeFeatureLayout(cfg);
+  // Streams do not support mid features
+  Config stream_cfg = cfg;
+  stream_cfg.mid_size = 0;
+  FeatureLayout stream_layout = ComputeFeatureLayout(stream_cfg);
+  
+  namespace fs = std::filesystem;
+  fs::path dir = fs::temp_directory_path() / ("magikacpp_alloc_" + std::to_string(std::random_device()()));
+  fs::create_directories(dir);
+  
+  int status = 0;
+  try {
+    std::mt19937 rng(7);
+    std::vector<std::vector<uint8_t>> contents;
+    std::vector<std::string> paths;
+    for (size_t size : kSizes) {
+      std::vector<uint8_t> content(size);
+      for (uint8_t& byte : content) {
+        byte = static_cast<uint8_t>(rng());
+      }
+      std::string path = (dir / ("f" + std::to_string(size))).string();
+      std::ofstream out(path, std::ios::binary);
+      out.write(reinterpret_cast<const char*>(content.data()), static_cast<std::streamsize>(content.size()));
+      out.close();
+      contents.push_back(content);
+      paths.push_back(path);
+    }
+  
+    Features features;
+    std::vector<int32_t> row(layout.row_size);
+    std::vector<uint16_t> row16(layout.row_size);
+    FeatureStream stream(stream_cfg);
+    const struct {
+      const char* name;
+      std::function<void(size_t)> extract;
+    } paths_tested[] = {
+      { "memory features", [&](size_t i) { ExtractFeatures(contents[i].data(), contents[i].size(), cfg, features); } },
+      { "memory int32 row", [&](size_t i) {
+          ExtractFeatures(contents[i].data(), contents[i].size(), cfg, layout, row.data());
+        } },
+      { "memory uint16 row", [&](size_t i) {
+          ExtractFeatures(contents[i].data(), contents[i].size(), cfg, layout, row16.data());
+        } },
+      { "seekable features", [&](size_t i) {
+          Seekable seekable(paths[i]);
+          ExtractFeaturesFromSeekable(seekable, cfg, features);
+        } },
+      { "seekable int32 row", [&](size_t i) {
+          Seekable seekable(paths[i]);
+          ExtractFeaturesFromSeekable(seekable, cfg, layout, row.data());
+        } },
+      { "seekable uint16 row", [&](size_t i) {
+          Seekable seekable(paths[i]);
+          ExtractFeaturesFromSeekable(seekable, cfg, layout, row16.data());
+        } },
+      { "stream int32 row", [&](size_t i) {
+          stream.Reset();
+          stream.Push(contents[i].data(), contents[i].size());
+          stream.Finish(stream_layout, row.data());
+        } },
+    };
+  
+    for (const auto& tested : paths_tested) {
+      double allocations = CountAllocations(paths, tested.extract);
+      std::printf("%s: %.2f allocations per file\n", tested.name, allocations);
+      if (allocations != 0) {
+        status = 1;
+      }
+    }
+  } catch (const std::exception& e) {
+    std::printf("Error: %s\n", e.what());
+    status = 1;
+  }
+  
+  fs::remove_all(dir);
+  return status;
+}
@@ -0,0 +1,379 @@
+// Parity test of the feature extraction paths: every source (memory,
+// Seekable, O_DIRECT, descriptor, mapping, io_uring batches, byte ranges
+// inside a larger file and streams) must produce the same int32 and uint16
+// rows and the same fingerprints as a straightforward reference
+// implementation, itself checked against ExtractFeatures/Flatten.
+#include "filefeatures.h"
+#include "featureengine.h"
+#include "fingerprint.h"
+#include "batchreader.h"
+#include "seekable.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const size_t kOffsets[4] = { k_offset_8000, k_offset_8800, k_offset_9000, k_offset_9800 };
+
+// Bytes placed before and after a file's content in the range test
+static const size_t kRangeMargin = 777;
+
+struct TestFile {
+  std::string path;
+  std::string description;
+  std::vector<uint8_t> content;
+};
+
+struct Expected {
+  std::vector<int32_t> row;
+  uint64_t fingerprint;
+};
+
+static size_t g_checks = 0;
+static size_t g_failures = 0;
+
+static bool IsSpace(uint8_t c) {
+  return c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r' || c == ' ';
+}
+
+// Reference appends one segment to the reference row and fingerprint,
+// padding bytes with prefix leading and as many trailing padding tokens
+// as needed to fill size
+static void Reference(std::vector<int32_t>& row, FeatureHasher& hasher, const uint8_t* bytes, size_t count,
+                      size_t prefix, size_t size, int32_t padding_token) {
+  size_t bytes_to_add = std::min(count, size - prefix);
+  row.insert(row.end(), prefix, padding_token);
+  row.insert(row.end(), bytes, bytes + bytes_to_add);
+  row.insert(row.end(), size - prefix - bytes_to_add, padding_token);
+  hasher.Segment(bytes, count, prefix, size, padding_token);
+}
+
+// ReferenceRow builds the row of a content the way the original
+// ExtractFeatures did, one segment after the other on whole blocks
+static Expected ReferenceRow(const std::vector<uint8_t>& content, const Config& cfg) {
+  size_t size = content.size();
+  size_t block = std::min(size, static_cast<size_t>(cfg.block_size));
+  const uint8_t* data = content.data();
+  
+  size_t beg_start = 0;
+  while (beg_start < block && IsSpace(data[beg_start])) {
+    beg_start++;
+  }
+  size_t beg_count = std::min(block - beg_start, static_cast<size_t>(cfg.beg_size));
+  
+  size_t end_stop = size;
+  while (end_stop > size - block && IsSpace(data[end_stop - 1])) {
+    end_stop--;
+  }
+  size_t end_count = std::min(end_stop - (size - block), static_cast<size_t>(cfg.end_size));
+  
+  Expected expected;
+  FeatureHasher hasher;
+  Reference(expected.row, hasher, data + beg_start, beg_count, 0, cfg.beg_size, cfg.padding_token);
+  if (cfg.mid_size > 0) {
+    size_t mid_size = static_cast<size_t>(cfg.mid_size);
+    size_t mid_start = size <= mid_size ? 0 : (size - mid_size) / 2;
+    size_t mid_count = std::min(size, mid_size);
+    Reference(expected.row, hasher, data + mid_start, mid_count, (mid_size - mid_count) / 2, mid_size,
+              cfg.padding_token);
+  }
+  Reference(expected.row, hasher, data + end_stop - end_count, end_count, cfg.end_size - end_count, cfg.end_size,
+            cfg.padding_token);
+  if (cfg.use_inputs_at_offsets) {
+    for (size_t offset : kOffsets) {
+      size_t count = offset < size ? std::min(size - offset, static_cast<size_t>(k_offset_size)) : 0;
+      Reference(expected.row, hasher, data + std::min(offset, size), count, 0, k_offset_size, cfg.padding_token);
+    }
+  }
+  expected.fingerprint = hasher.Digest();
+  return expected;
+}
+
+static void Check(bool ok, const TestFile& file, const char* cfg_name, const std::string& what) {
+  g_checks++;
+  if (!ok) {
+    if (g_failures < 20) {
+      std::printf("FAIL %s, %s (%zu bytes): %s\n", cfg_name, file.description.c_str(), file.content.size(),
+                  what.c_str());
+    }
+    g_failures++;
+  }
+}
+
+// CheckRow compares an int32 row and its fingerprint with the reference
+static void CheckRow(const std::vector<int32_t>& row, uint64_t fingerprint, const Expected& expected,
+                     const TestFile& file, const char* cfg_name, const std::string& source) {
+  Check(row == expected.row, file, cfg_name, source + " int32 row");
+  Check(fingerprint == expected.fingerprint, file, cfg_name, source + " int32 fingerprint");
+}
+
+// CheckRow16 compares a uint16 row and its fingerprint with the reference
+static void CheckRow16(const std::vector<uint16_t>& row, uint64_t fingerprint, const Expected& expected,
+                       const TestFile& file, const char* cfg_name, const std::string& source) {
+  Check(std::equal(row.begin(), row.end(), expected.row.begin(), expected.row.end()), file, cfg_name,
+        source + " uint16 row");
+  Check(fingerprint == expected.fingerprint, file, cfg_name, source + " uint16 fingerprint");
+}
+
+// CheckFeatures compares Features with the reference row and the first block
+static void CheckFeatures(const Features& features, const Expected& expected, const Config& cfg,
+                          const TestFile& file, const char* cfg_name, const std::string& source) {
+  Check(features.Flatten() == expected.row, file, cfg_name, source + " Flatten");
+  size_t block = std::min(file.content.size(), static_cast<size_t>(cfg.block_size));
+  Check(features.first_block == std::vector<uint8_t>(file.content.begin(), file.content.begin() + block), file,
+        cfg_name, source + " first block");
+}
+
+// Sizes just around every boundary of the configuration, and the offset
+// windows cut by the end of the file
+static std::vector<size_t> TestSizes(const std::vector<Config>& cfgs) {
+  std::set<size_t> sizes = { 0, 1, 2, 3, 100, 100000 };
+  for (const Config& cfg : cfgs) {
+    const size_t bounds[] = { static_cast<size_t>(cfg.beg_size), static_cast<size_t>(cfg.end_size),
+                              static_cast<size_t>(cfg.beg_size + cfg.end_size), static_cast<size_t>(cfg.mid_size),
+                              static_cast<size_t>(cfg.block_size), static_cast<size_t>(cfg.block_size) * 2 };
+    for (size_t bound : bounds) {
+      for (size_t size = bound > 0 ? bound - 1 : 0; size <= bound + 1; size++) {
+        sizes.insert(size);
+      }
+    }
+  }
+  for (size_t offset : kOffsets) {
+    for (size_t size = offset - 1; size <= offset + k_offset_size + 1; size++) {
+      sizes.insert(size);
+    }
+  }
+  return std::vector<size_t>(sizes.begin(), sizes.end());
+}
+
+// MakeContent fills a content of the given size with random bytes, without
+// whitespace unless asked to, and leading and trailing whitespace runs
+static std::vector<uint8_t> MakeContent(std::mt19937& rng, size_t size, bool any_byte, size_t leading,
+                                        size_t trailing) {
+  static const char kSpaces[] = "\t\n\v\f\r ";
+  std::vector<uint8_t> content(size);
+  for (uint8_t& byte : content) {
+    do {
+      byte = static_cast<uint8_t>(rng());
+    } while (!any_byte && IsSpace(byte));
+  }
+  leading = std::min(leading, size);
+  trailing = std::min(trailing, size - leading);
+  for (size_t i = 0; i < leading; i++) {
+    content[i] = static_cast<uint8_t>(kSpaces[rng() % 6]);
+  }
+  for (size_t i = 0; i < trailing; i++) {
+    content[size - 1 - i] = static_cast<uint8_t>(kSpaces[rng() % 6]);
+  }
+  return content;
+}
+
+static void WriteFile(const std::string& path, const std::vector<uint8_t>& bytes) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+  if (!out) {
+    throw std::runtime_error("Cannot write " + path);
+  }
+}
+
+static void TestConfig(const Config& cfg, const char* cfg_name, const std::vector<TestFile>& files,
+                       const std::string& range_path, const std::vector<size_t>& range_offsets) {
+  FeatureLayout layout = ComputeFeatureLayout(cfg);
+  std::vector<int32_t> row(layout.row_size);
+  std::vector<uint16_t> row16(layout.row_size);
+  std::vector<Expected> expected;
+  for (const TestFile& file : files) {
+    expected.push_back(ReferenceRow(file.content, cfg));
+  }
+  
+  Seekable range_file(range_path);
+  FeatureReads reads;
+  for (size_t i = 0; i < files.size(); i++) {
+    const TestFile& file = files[i];
+    const Expected& ref = expected[i];
+    const uint8_t* data = file.content.data();
+    size_t size = file.content.size();
+    uint64_t fingerprint;
+  
+    // The reference against the original vector API
+    CheckFeatures(ExtractFeatures(file.content, cfg), ref, cfg, file, cfg_name, "ExtractFeatures");
+  
+    // In memory
+    fingerprint = ExtractFeatures(data, size, cfg, layout, row.data());
+    CheckRow(row, fingerprint, ref, file, cfg_name, "memory");
+    fingerprint = ExtractFeatures(data, size, cfg, layout, row16.data());
+    CheckRow16(row16, fingerprint, ref, file, cfg_name, "memory");
+  
+    // Seekable by path, with and without O_DIRECT
+    for (bool direct_io : { false, true }) {
+      ReadHints hints;
+      hints.direct_io = direct_io;
+      std::string source = direct_io ? "direct seekable" : "seekable";
+      Seekable seekable(file.path, hints);
+      CheckFeatures(ExtractFeaturesFromSeekable(seekable, cfg), ref, cfg, file, cfg_name, source);
+      fingerprint = ExtractFeaturesFromSeekable(seekable, cfg, layout, row.data());
+      CheckRow(row, fingerprint, ref, file, cfg_name, source);
+      fingerprint = ExtractFeaturesFromSeekable(seekable, cfg, layout, row16.data());
+      CheckRow16(row16, fingerprint, ref, file, cfg_name, source);
+    }
+  
+#ifndef _WIN32
+    // Seekable on a descriptor opened by the caller
+    int fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+    Check(fd >= 0, file, cfg_name, "open");
+    if (fd >= 0) {
+      Seekable seekable(fd);
+      fingerprint = ExtractFeaturesFromSeekable(seekable, cfg, layout, row.data());
+      CheckRow(row, fingerprint, ref, file, cfg_name, "fd");
+      fingerprint = ExtractFeaturesFromSeekable(seekable, cfg, layout, row16.data());
+      CheckRow16(row16, fingerprint, ref, file, cfg_name, "fd");
+      close(fd);
+    }
+#endif
+  
+    // Views of a mapping
+    MappedSeekable mapped(file.path);
+    Check(!mapped.size_changed(), file, cfg_name, "mapped size");
+    fingerprint = ExtractFeatures(mapped.data(), mapped.size(), cfg, layout, row.data());
+    CheckRow(row, fingerprint, ref, file, cfg_name, "mapped");
+    fingerprint = ExtractFeatures(mapped.data(), mapped.size(), cfg, layout, row16.data());
+    CheckRow16(row16, fingerprint, ref, file, cfg_name, "mapped");
+  
+    // A byte range of a larger file holding every content one after the other
+    PlanFeatureReads(size, cfg, reads, range_offsets[i]);
+    range_file.read_ranges(reads.ranges, reads.range_count);
+    CheckFeatures(ExtractFeaturesFromReads(reads, cfg), ref, cfg, file, cfg_name, "range");
+    fingerprint = ExtractFeaturesFromReads(reads, cfg, layout, row.data());
+    CheckRow(row, fingerprint, ref, file, cfg_name, "range");
+    fingerprint = ExtractFeaturesFromReads(reads, cfg, layout, row16.data());
+    CheckRow16(row16, fingerprint, ref, file, cfg_name, "range");
+  
+    // Streams pushed in uneven chunks, mid features need the size upfront
+    if (cfg.mid_size == 0) {
+      FeatureStream stream(cfg);
+      for (size_t pos = 0, chunk = 1; pos < size; pos += chunk, chunk = chunk * 3 + 1) {
+        stream.Push(data + pos, std::min(chunk, size - pos));
+      }
+      Features features;
+      stream.Finish(features);
+      CheckFeatures(features, ref, cfg, file, cfg_name, "stream");
+      fingerprint = stream.Finish(layout, row.data());
+      CheckRow(row, fingerprint, ref, file, cfg_name, "stream");
+      fingerprint = stream.Finish(layout, row16.data());
+      CheckRow16(row16, fingerprint, ref, file, cfg_name, "stream");
+    }
+  }
+  
+  // io_uring batches, with several queue depths and hints; BatchReader
+  // falls back to Seekable where io_uring is not available
+  std::vector<std::string> paths;
+  for (const TestFile& file : files) {
+    paths.push_back(file.path);
+  }
+  for (unsigned depth : { 1u, 7u, 256u }) {
+    ReadHints hints;
+    hints.random_access = depth != 7;
+    hints.drop_cache = depth == 7;
+    BatchReader reader(cfg, depth, hints);
+    std::string source = std::string(reader.uses_io_uring() ? "io_uring" : "batch fallback") + " depth " +
+                         std::to_string(depth);
+    std::vector<bool> seen(files.size(), false);
+    reader.Read(paths, [&](const BatchItem& item) {
+      const TestFile& file = files[item.index];
+      seen[item.index] = true;
+      Check(item.error.empty(), file, cfg_name, source + " error " + item.error);
+      if (!item.error.empty()) {
+        return;
+      }
+      uint64_t fingerprint = ExtractFeaturesFromReads(*item.reads, cfg, layout, row.data());
+      CheckRow(row, fingerprint, expected[item.index], file, cfg_name, source);
+      fingerprint = ExtractFeaturesFromReads(*item.reads, cfg, layout, row16.data());
+      CheckRow16(row16, fingerprint, expected[item.index], file, cfg_name, source);
+    });
+    for (size_t i = 0; i < files.size(); i++) {
+      Check(seen[i], files[i], cfg_name, source + " callback");
+    }
+  }
+}
+
+int main() {
+  std::vector<Config> cfgs(4);
+  const char* cfg_names[] = { "standard_v3", "mid", "offsets", "offsets in blocks" };
+  for (Config& cfg : cfgs) {
+    cfg.beg_size = k_beg_size;
+    cfg.mid_size = k_mid_size;
+    cfg.end_size = k_end_size;
+    cfg.padding_token = k_padding_token;
+    cfg.block_size = k_block_size;
+    cfg.use_inputs_at_offsets = false;
+  }
+  cfgs[1].mid_size = 512;
+  cfgs[2].beg_size = 512;
+  cfgs[2].end_size = 256;
+  cfgs[2].use_inputs_at_offsets = true;
+  // Blocks reaching past the first offsets, and a mid segment
+  cfgs[3] = cfgs[2];
+  cfgs[3].block_size = 0x8804;
+  cfgs[3].mid_size = 100;
+  
+  namespace fs = std::filesystem;
+  fs::path dir = fs::temp_directory_path() / ("magikacpp_parity_" + std::to_string(std::random_device()()));
+  fs::create_directories(dir);
+  
+  int status = 0;
+  try {
+    // Whitespace runs straddling the sizes the features and reads depend on
+    std::mt19937 rng(20240601);
+    std::vector<TestFile> files;
+    std::vector<uint8_t> range_content(kRangeMargin, 'x');
+    std::vector<size_t> range_offsets;
+    for (size_t size : TestSizes(cfgs)) {
+      const struct {
+        const char* name;
+        bool any_byte;
+        size_t leading;
+        size_t trailing;
+      } patterns[] = {
+        { "random", true, 0, 0 },
+        { "no whitespace", false, 0, 0 },
+        { "all whitespace", false, size, 0 },
+        { "whitespace around beg/end", false, k_beg_size + 1, k_end_size - 1 },
+        { "whitespace around the blocks", false, k_block_size - 1, k_block_size + 1 },
+      };
+      for (const auto& pattern : patterns) {
+        TestFile file;
+        file.content = MakeContent(rng, size, pattern.any_byte, pattern.leading, pattern.trailing);
+        file.description = pattern.name;
+        file.path = (dir / ("f" + std::to_string(files.size()))).string();
+        WriteFile(file.path, file.content);
+        range_offsets.push_back(range_content.size());
+        range_content.insert(range_content.end(), file.content.begin(), file.content.end());
+        range_content.insert(range_content.end(), kRangeMargin, 'x');
+        files.push_back(std::move(file));
+      }
+    }
+    std::string range_path = (dir / "ranges").string();
+    WriteFile(range_path, range_content);
+  
+    for (size_t c = 0; c < cfgs.size(); c++) {
+      TestConfig(cfgs[c], cfg_names[c], files, range_path, range_offsets);
+    }
+    std::printf("%zu files, %zu checks, %zu failures\n", files.size(), g_checks, g_failures);
+    status = g_failures == 0 ? 0 : 1;
+  } catch (const std::exception& e) {
+    std::printf("Error: %s\n", e.what());
+    status = 1;
+  }
+  
+  fs::remove_all(dir);
+  return status;
+}